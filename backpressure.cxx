@@ -0,0 +1,69 @@
+#include "backpressure.h"
+
+// least to most aggressive, frame skipping is tried before touching the
+// device since it takes effect immediately and is cheap to undo. Decoded
+// pixels per second relative to the first step: 1, 1/2, 1/4, 1/8, 1/16
+static const CaptureLoad LOAD_LADDER[] = {
+  {1, 1, 1},
+  {2, 1, 1},
+  {2, 2, 1},
+  {1, 2, 2},
+  {2, 2, 2},
+};
+
+static const unsigned int LOAD_LEVELS = sizeof(LOAD_LADDER) / sizeof(LOAD_LADDER[0]);
+
+BackpressureController::BackpressureController(BackpressureSetup setup):
+  setup_(setup),
+  latency_sum_us_{0},
+  latency_count_{0},
+  level_{0},
+  latency_ms_{0},
+  over_ticks_{0},
+  under_ticks_{0} {
+}
+
+void BackpressureController::report_decode(std::chrono::microseconds latency) {
+  latency_sum_us_ += latency.count();
+  latency_count_++;
+}
+
+CaptureLoad BackpressureController::load() const {
+  return LOAD_LADDER[level_];
+}
+
+bool BackpressureController::tick(int queue_depth) {
+  uint64_t sum = latency_sum_us_.exchange(0);
+  uint32_t count = latency_count_.exchange(0);
+
+  if (count > 0) {
+    // smooth with an EWMA (alpha = 1/2) so single slow frames don't count
+    unsigned int avg_ms = static_cast<unsigned int>(sum / count / 1000);
+    latency_ms_ = (latency_ms_ + avg_ms) >> 1;
+  }
+
+  if (!setup_.enabled_)
+    return false;
+
+  bool overloaded = (latency_ms_ > setup_.high_latency_ms_) ||
+                    (queue_depth > static_cast<int>(setup_.max_queue_depth_));
+  bool idle = (latency_ms_ < setup_.low_latency_ms_) &&
+              (queue_depth <= static_cast<int>(setup_.max_queue_depth_ / 2));
+
+  over_ticks_ = overloaded ? over_ticks_ + 1 : 0;
+  under_ticks_ = idle ? under_ticks_ + 1 : 0;
+
+  if ((over_ticks_ >= setup_.escalate_ticks_) && (level_ + 1 < LOAD_LEVELS)) {
+    level_++;
+    over_ticks_ = 0;
+    return true;
+  }
+
+  if ((under_ticks_ >= setup_.relax_ticks_) && (level_ > 0)) {
+    level_--;
+    under_ticks_ = 0;
+    return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,61 @@
+#ifndef BACKPRESSURE_H_
+#define BACKPRESSURE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+struct BackpressureSetup {
+  bool enabled_;
+  unsigned int high_latency_ms_; // escalate when decode latency exceeds this
+  unsigned int low_latency_ms_;  // relax when decode latency drops below this
+  unsigned int max_queue_depth_; // escalate when the frame queue exceeds this
+  unsigned int escalate_ticks_;  // consecutive overloaded ticks to escalate
+  unsigned int relax_ticks_;     // consecutive idle ticks to relax
+};
+
+/* Capture settings for one step of the load ladder. Each step halves the
+ * pixels per second reaching the decoder compared to the one before
+ * (frames / (keep_every_ * fps_div_), pixels / res_div_ squared). */
+struct CaptureLoad {
+  unsigned int keep_every_; // pass 1 of every N frames, skip the rest at source
+  unsigned int fps_div_;    // divide configured fps via VIDIOC_S_PARM
+  unsigned int res_div_;    // divide configured resolution (stream restart)
+};
+
+/* Closed-loop controller adapting capture work to decode load.
+ *
+ * The decode thread reports the capture-to-decoded latency of every frame,
+ * the capture loop calls tick() periodically with the frame queue depth and
+ * applies the returned CaptureLoad. Level changes need the condition to hold
+ * for several ticks in a row, and relaxing takes longer than escalating, so
+ * the capture settings don't oscillate.
+ */
+class BackpressureController {
+  public:
+    explicit BackpressureController(BackpressureSetup setup);
+
+    // decode thread: latency from capture until the decode finished
+    void report_decode(std::chrono::microseconds latency);
+
+    // capture thread: returns true if the load level changed
+    bool tick(int queue_depth);
+
+    unsigned int level() const { return level_; }
+    CaptureLoad load() const;
+    unsigned int latency_ms() const { return latency_ms_; }
+    bool enabled() const { return setup_.enabled_; }
+  private:
+    BackpressureSetup setup_;
+
+    // written by the decode thread, drained by tick()
+    std::atomic<uint64_t> latency_sum_us_;
+    std::atomic<uint32_t> latency_count_;
+
+    unsigned int level_;
+    unsigned int latency_ms_; // smoothed decode latency
+    unsigned int over_ticks_;
+    unsigned int under_ticks_;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "consensus.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+// reads further apart than 1/TRACK_DIVISOR of the frame width are
+// different codes
+static const int TRACK_DIVISOR = 8;
+
+static const unsigned int DEFAULT_WINDOW_MS = 1000;
+
+ConsensusRule parse_consensus_rule(const std::string& arg) {
+  ConsensusRule r {0, 0, std::chrono::milliseconds{DEFAULT_WINDOW_MS}};
+
+  std::istringstream in(arg);
+  std::string k, n, ms;
+  std::getline(in, k, '/');
+  std::getline(in, n, '/');
+  std::getline(in, ms, '/');
+
+  try {
+    r.k_ = std::stoul(k);
+    r.n_ = std::stoul(n);
+    if (!ms.empty()) { r.window_ = std::chrono::milliseconds{std::stoul(ms)}; }
+  } catch (const std::logic_error&) {
+    throw std::invalid_argument("Consensus rule must be K/N[/ms]: " + arg);
+  }
+
+  if ((r.k_ == 0) || (r.k_ > r.n_))
+    throw std::invalid_argument("Consensus needs 1 <= K <= N: " + arg);
+
+  return r;
+}
+
+void parse_consensus_override(const std::string& arg, ConsensusSetup& setup) {
+  auto eq = arg.find('=');
+  if (eq == std::string::npos)
+    throw std::invalid_argument("Consensus override must be FORMAT=K/N[/ms]: " + arg);
+
+  setup.formats_[arg.substr(0, eq)] = parse_consensus_rule(arg.substr(eq + 1));
+}
+
+ConsensusFilter::ConsensusFilter(ConsensusSetup setup):
+  setup_(setup),
+  passed_{0},
+  held_{0} {
+}
+
+const ConsensusRule& ConsensusFilter::rule(const std::string& format) const {
+  auto it = setup_.formats_.find(format);
+  if (it != setup_.formats_.end())
+    return it->second;
+
+  return IsMatrixFormat(ZXing::BarcodeFormatFromString(format)) ?
+         setup_.matrix_ : setup_.linear_;
+}
+
+bool ConsensusFilter::update(const ScanResult& r) {
+  if (!setup_.enabled_) return true;
+
+  const ConsensusRule& cr = rule(r.format_);
+  const Frame& f = *r.frame_;
+  auto now = f.timestamp();
+
+  int x = 0, y = 0;
+  for (auto& rp : r.result_points_) {
+    x += rp.first;
+    y += rp.second;
+  }
+  if (!r.result_points_.empty()) {
+    x /= static_cast<int>(r.result_points_.size());
+    y /= static_cast<int>(r.result_points_.size());
+  }
+
+  // forget votes that left the window, and tracks without votes
+  for (auto& t : tracks_) {
+    const auto window = rule(t.format_).window_;
+    t.votes_.erase(std::remove_if(t.votes_.begin(), t.votes_.end(),
+                     [&](const Vote& v) { return now - v.time_ > window; }),
+                   t.votes_.end());
+  }
+  tracks_.erase(std::remove_if(tracks_.begin(), tracks_.end(),
+                  [](const Track& t) { return t.votes_.empty(); }),
+                tracks_.end());
+
+  // nearest track of the same code type, moving codes keep their track
+  const int max_distance = f.cols() / TRACK_DIVISOR;
+  Track* track = nullptr;
+  int best = max_distance + 1;
+  for (auto& t : tracks_) {
+    if ((t.device_ != f.device()) || (t.format_ != r.format_)) continue;
+
+    int d = std::abs(t.x_ - x) + std::abs(t.y_ - y);
+    if (d < best) {
+      best = d;
+      track = &t;
+    }
+  }
+
+  if (track == nullptr) {
+    tracks_.push_back(Track{f.device(), r.format_, x, y, {}});
+    track = &tracks_.back();
+  }
+
+  track->x_ = x;
+  track->y_ = y;
+  track->votes_.push_back(Vote{now, r.text_});
+  if (track->votes_.size() > cr.n_) {
+    track->votes_.erase(track->votes_.begin());
+  }
+
+  unsigned int agree = std::count_if(track->votes_.begin(), track->votes_.end(),
+                          [&](const Vote& v) { return v.text_ == r.text_; });
+
+  if (agree >= cr.k_) {
+    passed_++;
+    return true;
+  }
+
+  held_++;
+  return false;
+}
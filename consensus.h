@@ -0,0 +1,73 @@
+#ifndef CONSENSUS_H_
+#define CONSENSUS_H_
+
+#include "reader.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+/* k_ of the last n_ reads of a code, within window_, must agree */
+struct ConsensusRule {
+  unsigned int k_;
+  unsigned int n_;
+  std::chrono::milliseconds window_;
+};
+
+struct ConsensusSetup {
+  bool enabled_;
+  ConsensusRule linear_;                       // 1D formats
+  ConsensusRule matrix_;                       // 2D, has its own ECC
+  std::map<std::string, ConsensusRule> formats_; // per format overrides
+};
+
+// "K/N[/ms]", throws std::invalid_argument on malformed rules
+ConsensusRule parse_consensus_rule(const std::string& arg);
+
+// "FORMAT=K/N[/ms]", throws std::invalid_argument on malformed arguments
+void parse_consensus_override(const std::string& arg, ConsensusSetup& setup);
+
+/* Temporal vote over consecutive frames.
+ *
+ * Reads are tracked per code by device, format and position (centroid of
+ * the result points), so two labels in view vote separately. A read is
+ * only let through once at least k_ of the track's last n_ reads agree on
+ * its text; a frame that disagrees with the majority is held back. That
+ * keeps partial or wrong 1D reads from cheap decode settings away from the
+ * sinks at the cost of k_ - 1 frames of latency.
+ */
+class ConsensusFilter {
+  public:
+    explicit ConsensusFilter(ConsensusSetup setup);
+
+    // r must be a read (text_ not empty), true if it reached consensus
+    bool update(const ScanResult& r);
+
+    bool enabled() const { return setup_.enabled_; }
+    unsigned long passed() const { return passed_; }
+    unsigned long held() const { return held_; }
+    void reset_stats() { passed_ = held_ = 0; }
+  private:
+    struct Vote {
+      FrameClock::time_point time_;
+      std::string text_;
+    };
+
+    struct Track {
+      unsigned int device_;
+      std::string format_;
+      int x_;
+      int y_;
+      std::vector<Vote> votes_; // oldest first, at most n_
+    };
+
+    const ConsensusRule& rule(const std::string& format) const;
+
+    ConsensusSetup setup_;
+    std::vector<Track> tracks_;
+    unsigned long passed_;
+    unsigned long held_;
+};
+
+#endif
@@ -1,34 +1,53 @@
 #include "reader.h"
 #include "decode_thread.h"
+#include "trace.h"
 
 #include <spdlog/spdlog.h>
-#include <CImg.h>
 
 #include <chrono>
-#include <atomic>
 #include <vector>
 #include <cstdio>
 
-using namespace cimg_library;
+static const unsigned int THUMB_QUALITY = 60;
+
+static void log_binarizer_stats(const char* name, const BinarizerStats& s) {
+  if (s.attempts_ == 0) return;
+
+  spdlog::get("console")->info("{} binarizer: hits {}/{}, avg {}us", name,
+                               s.hits_, s.attempts_,
+                               s.time_.count() / s.attempts_);
+}
+
+static void log_format_stats(const std::vector<FormatStats>& stats) {
+  for (auto& s : stats) {
+    if (s.attempts_ == 0) continue;
+
+    // the combined reader (no --adaptive-formats) doesn't time formats
+    if (s.timed_ == 0) {
+      spdlog::get("console")->info("{}: hits {}/{}, hit rate {:.3f}",
+                                   ZXing::ToString(s.format_), s.hits_,
+                                   s.attempts_, s.hit_rate_);
+      continue;
+    }
+
+    spdlog::get("console")->info("{}: hits {}/{}, avg {}us, hit rate {:.3f}{}",
+                                 ZXing::ToString(s.format_), s.hits_,
+                                 s.attempts_, s.time_.count() / s.timed_,
+                                 s.hit_rate_, s.demoted_ ? " (demoted)" : "");
+  }
+}
 
 void decode_thread(DecoderSetup ds,
                    ThreadsafeQueue<FramePtr>& frame_queue,
                    ThreadsafeQueue<ScanResult>& result_queue,
-                   std::atomic_bool& exit_flag) {
+                   LatestSlot<ScanResult>& preview_slot,
+                   BackpressureController& controller,
+                   MemoryBudget& budget,
+                   Shutdown& shutdown) {
   
   auto logger = spdlog::get("console");
+  TRACE_THREAD("decode");
   
-#ifdef XDISPLAY
-  CImgDisplay main_disp(ds.res_x_, ds.res_y_, "barcode preview", 3, false, true);
-  if (ds.enable_preview_) {
-    main_disp.show();
-  }
-#else
-  if (ds.enable_preview_) {
-    logger->warn("Not compiled with X11 support - cannot show preview");
-  }
-#endif
-
   std::vector<ZXing::BarcodeFormat> fmts;
   for(auto& f: ds.formats_) {
     auto bf = ZXing::BarcodeFormatFromString(f);
@@ -40,54 +59,150 @@ void decode_thread(DecoderSetup ds,
     fmts.push_back(bf);
   }
 
-  BarcodeReader br(fmts);
+  BarcodeReader br(fmts, ds.try_harder_, true, ds.binarizer_, ds.scanlines_,
+                   ds.format_order_);
+  ResultCache cache(ds.cache_);
+  ConsensusFilter consensus(ds.consensus_);
+
+  const auto stats_interval = std::chrono::seconds{8};
+  auto stats_time = std::chrono::steady_clock::now();
   
-  auto last_post_time = std::chrono::steady_clock::now();
   auto last_scan_time = std::chrono::steady_clock::now();
   std::string last_scan;
+
+  // per frame events are counted and logged with the stats, not one by one
+  unsigned long undecodable = 0;
+  unsigned long backoff_drops = 0;
+
+  // focus scores of all frames and of the ones that read, to tune the camera
+  uint64_t sharpness_sum = 0, read_sharpness_sum = 0;
+  unsigned long sharpness_count = 0, read_sharpness_count = 0;
   
   while(true) {
-    FramePtr p = frame_queue.pop_with_timeout(1);
+    FramePtr p;
+    {
+      TRACE_SCOPE(wait_span, "queue wait");
+      p = frame_queue.wait_and_pop();
+      TRACE_FRAME(wait_span, p ? p->id() : 0);
+    }
     
-    if (exit_flag) { break; } // exit flag
-    if (p == nullptr) { continue; } // timeout
+    // queue is closed on shutdown
+    if ((p == nullptr) || shutdown.requested()) { break; }
 
-    auto res = br.scan(p);
+    ScanResult res;
+    bool decoded;
+    {
+      TRACE_SPAN("luma", p->id());
+      decoded = p->compute_luma();
+    }
+    if (!decoded) {
+      undecodable++;
+      continue;
+    }
+
+    bool cached;
+    {
+      TRACE_SPAN("cache lookup", p->id());
+      cached = cache.lookup(*p, res);
+    }
+    if (cached) {
+      res.frame_ = p;
+      res.frame_id_ = p->id();
+      res.sharpness_ = p->sharpness();
+    } else {
+      res = br.scan(p);
+    }
     
     auto now_time = std::chrono::steady_clock::now();
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+          now_time - p->timestamp());
+    controller.report_decode(latency);
+    if (ds.truth_ != nullptr) {
+      ds.truth_->check(res, latency);
+    }
 
-    // post results provided backoff conditions met
+    sharpness_sum += res.sharpness_;
+    sharpness_count++;
     if (!res.text_.empty()) {
+      read_sharpness_sum += res.sharpness_;
+      read_sharpness_count++;
+    }
+
+    // cached reads already had consensus, fresh ones are held back until
+    // enough frames agree
+    bool agreed = !res.text_.empty() && (cached || consensus.update(res));
+    if (agreed && !cached) {
+      cache.store(*p, res);
+    }
+
+    // post results provided backoff conditions met
+    if (agreed) {
+      TRACE_SPAN("backoff", p->id());
       // only post the result if we're backoff_seconds_ from the same result
       // last being scanned
       bool b = ((now_time - last_scan_time) <= std::chrono::seconds{BACKOFF_SECS});
       if ((res.text_ != last_scan) || (!b)) {
-        result_queue.push(res);
+        // don't hold on to whole frames while the sinks catch up, fall back
+        // to a thumbnail once over budget
+        auto mode = budget.exceeded() ? PayloadMode::THUMBNAIL : ds.payload_;
+        result_queue.push(compact_result(res, mode, ds.thumb_width_,
+                                         THUMB_QUALITY, &budget));
       } else {
-        logger->debug("Dropping result due to backoff");
+        backoff_drops++;
       }
 
       last_scan = res.text_;
       last_scan_time = now_time;
-      last_post_time = now_time;
     }
 
-    // periodically post images, preview
-    if (now_time - last_post_time > std::chrono::seconds{1}) {
-      last_post_time = now_time;
-      if (result_queue.size() < 5) {
-        result_queue.push(res);
-      }
-    }
-
-#ifdef XDISPLAY
+    // rendering and publishing happens in preview_thread, this only swaps
+    // the latest frame in
     if (ds.enable_preview_) {
-      CImg<unsigned char> img(p->buf(), 3, p->cols(), p->rows());
-      // CImg needs a different byte order
-      img.permute_axes("YZCX");
-      img.display(main_disp);
+      preview_slot.put(res);
     }
-#endif
 
+    if (now_time - stats_time >= stats_interval) {
+      log_binarizer_stats("global", br.global_stats());
+      log_binarizer_stats("hybrid", br.hybrid_stats());
+      log_binarizer_stats("scanline", br.scanline_stats());
+      log_format_stats(br.format_stats());
+      if (br.scanline_stats().attempts_ > 0) {
+        logger->info("scanline near misses escalated to full decode {}",
+                     br.escalations());
+      }
+      br.reset_stats();
+
+      if (cache.enabled()) {
+        logger->info("result cache hits {}/{} ({}%)", cache.hits(),
+                     cache.lookups(),
+                     cache.lookups() ? (100 * cache.hits() / cache.lookups()) : 0);
+        cache.reset_stats();
+      }
+
+      if (sharpness_count > 0) {
+        logger->info("sharpness avg {}, of frames with reads {}",
+                     sharpness_sum / sharpness_count,
+                     read_sharpness_count ? read_sharpness_sum / read_sharpness_count : 0);
+        sharpness_sum = read_sharpness_sum = 0;
+        sharpness_count = read_sharpness_count = 0;
+      }
+
+      if ((undecodable > 0) || (backoff_drops > 0)) {
+        logger->info("undecodable frames {}, results dropped by backoff {}",
+                     undecodable, backoff_drops);
+        undecodable = backoff_drops = 0;
+      }
+
+      if (consensus.enabled()) {
+        logger->info("consensus passed {}, held back {}", consensus.passed(),
+                     consensus.held());
+        consensus.reset_stats();
+      }
+
+      if (ds.truth_ != nullptr) {
+        ds.truth_->log_report("synthetic", true);
+      }
+      stats_time = now_time;
+    }
   }
 }
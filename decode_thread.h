@@ -2,26 +2,42 @@
 #define DECODE_THREAD_H_
 #include "frame.h"
 #include "threadsafe_queue.h"
+#include "shutdown.h"
+#include "backpressure.h"
+#include "result_cache.h"
+#include "consensus.h"
+#include "reader.h"
+#include "latest_slot.h"
+#include "memory_budget.h"
+#include "frame_image.h"
+#include "ground_truth.h"
 
-#include <atomic>
 #include <string>
 #include <vector>
 
 const int BACKOFF_SECS = 2;
 
-struct ScanResult;
-
 struct DecoderSetup {
   std::vector<std::string> formats_;
-  bool enable_preview_;
-  unsigned int res_x_;
-  unsigned int res_y_;
+  bool enable_preview_; // feed preview_slot
+  ResultCacheSetup cache_;
+  BinarizerMode binarizer_;
+  bool try_harder_;          // off is cheaper, pair with consensus_
+  ScanlineSetup scanlines_;  // rows_ 0 = full frame decode only
+  FormatOrderSetup format_order_;
+  ConsensusSetup consensus_;
+  PayloadMode payload_;      // what a queued result keeps of its frame
+  unsigned int thumb_width_; // width of thumbnail payloads
+  GroundTruth* truth_;       // synthetic source, check reads against it
 };
 
 void decode_thread(DecoderSetup ds,
                    ThreadsafeQueue<FramePtr>& frame_queue,
                    ThreadsafeQueue<ScanResult>& result_queue,
-                   std::atomic_bool& exit_flag);
+                   LatestSlot<ScanResult>& preview_slot,
+                   BackpressureController& controller,
+                   MemoryBudget& budget,
+                   Shutdown& shutdown);
   
 
 #endif
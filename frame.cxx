@@ -0,0 +1,74 @@
+#include "frame.h"
+#include "jpeg_luma.h"
+#include "sharpness.h"
+
+#include <vector>
+
+static const unsigned int THUMB_W = 9; // one extra column for the gradient
+static const unsigned int THUMB_H = 8;
+
+std::atomic<uint64_t> Frame::next_id_{1}; // 0 = no frame
+
+bool Frame::compute_luma() {
+  if (luma_done_) return true;
+
+  if (format_ == FrameFormat::JPEG) {
+    luma_ = decode_jpeg_luma(buffer_, buf_length_, luma_scale_,
+                             luma_cols_, luma_rows_);
+    if (luma_ == nullptr) return false;
+    charge(luma_bytes());
+  }
+
+  const unsigned int w = luma_cols_, h = luma_rows_;
+  uint32_t bins[THUMB_H][THUMB_W] = {};
+
+  // thumbnail bin for each column, avoids a division per pixel
+  std::vector<unsigned char> col_bin(w);
+  uint64_t bin_cols[THUMB_W] = {};
+  for (unsigned int x = 0; x < w; x++) {
+    col_bin[x] = static_cast<unsigned char>(x * THUMB_W / w);
+    bin_cols[col_bin[x]]++;
+  }
+
+  if (format_ == FrameFormat::RGB24) {
+    luma_ = new unsigned char[luma_bytes()];
+    charge(luma_bytes());
+  }
+
+  const unsigned char* src = (format_ == FrameFormat::RGB24) ? buffer_ : luma();
+  unsigned char* dst = luma_;
+
+  for (unsigned int y = 0; y < h; y++) {
+    uint32_t* row_bins = bins[y * THUMB_H / h];
+
+    if (format_ == FrameFormat::RGB24) {
+      for (unsigned int x = 0; x < w; x++, src += 3) {
+        // same weights as convert_to_greyscale: (2R + 5G + B) / 8
+        int tmp = (src[0] << 1) + (src[1] << 2) + src[1] + src[2];
+        unsigned char l = static_cast<unsigned char>(tmp >> 3);
+        *dst++ = l;
+        row_bins[col_bin[x]] += l;
+      }
+    } else {
+      for (unsigned int x = 0; x < w; x++) {
+        row_bins[col_bin[x]] += *src++;
+      }
+    }
+  }
+
+  // difference hash: one bit per horizontally adjacent pair of bins. Bins
+  // in a row cover the same rows, so comparing means only needs the sums
+  // cross-multiplied by the column counts.
+  uint64_t hash = 0;
+  for (unsigned int y = 0; y < THUMB_H; y++) {
+    for (unsigned int x = 0; x + 1 < THUMB_W; x++) {
+      bool brighter = (bins[y][x] * bin_cols[x + 1]) > (bins[y][x + 1] * bin_cols[x]);
+      hash = (hash << 1) | (brighter ? 1 : 0);
+    }
+  }
+
+  thumb_hash_ = hash;
+  sharpness_ = gradient_energy(luma(), h, w, w, 1);
+  luma_done_ = true;
+  return true;
+}
@@ -3,17 +3,24 @@
 
 #include <cstddef>
 #include <memory>
+#include <chrono>
+#include <cstdint>
 #include <cassert>
+#include <atomic>
+
+#include "memory_budget.h"
 
 using std::size_t;
 
 class Frame;
 
 using FramePtr = std::shared_ptr<Frame>;
+using FrameClock = std::chrono::steady_clock;
 
 enum class FrameFormat {
   RGB24,
-  GREY8
+  GREY8,
+  JPEG // compressed MJPEG frame as delivered by the camera
 };
 
 /* Represent a capture frame from the webcam */
@@ -25,7 +32,19 @@ class Frame {
           buf_length_(bytes),
           rows_(rows),
           cols_(cols),
-          format_(format) {
+          format_(format),
+          id_(next_id_++),
+          device_(0),
+          timestamp_(FrameClock::now()),
+          luma_(nullptr),
+          luma_rows_(rows),
+          luma_cols_(cols),
+          luma_scale_(1),
+          thumb_hash_(0),
+          sharpness_(0),
+          luma_done_(false),
+          budget_(nullptr),
+          charged_(0) {
 
       // copy the frame contents from source
       for(unsigned int i = 0; i < bytes; i++) {
@@ -34,8 +53,11 @@ class Frame {
     }
     
     virtual ~Frame() {
+      if (budget_ != nullptr) { budget_->release(charged_); }
       delete[] buffer_;
       buffer_ = nullptr;
+      delete[] luma_;
+      luma_ = nullptr;
     }
 
     const unsigned char* buf() const { return buffer_; }
@@ -45,9 +67,60 @@ class Frame {
     unsigned int cols() const { return cols_; }
     FrameFormat format() const { return format_; }
 
+    /* sequence number, unique across devices, to follow a frame through
+     * the pipeline (traces) */
+    uint64_t id() const { return id_; }
+    void set_id(uint64_t id) { id_ = id; } // derived frames keep the id
+
+    /* index of the capture device this frame came from */
+    unsigned int device() const { return device_; }
+    void set_device(unsigned int device) { device_ = device; }
+
+    /* account this frame's buffers (and a later luma plane) against budget
+     * until the frame is destroyed */
+    void set_budget(MemoryBudget* budget) {
+      assert(budget_ == nullptr);
+      budget_ = budget;
+      charge(buf_length_ + (luma_ != nullptr ? luma_bytes() : 0));
+    }
+
+    /* time the frame was captured, used for latency measurement */
+    FrameClock::time_point timestamp() const { return timestamp_; }
+
+    /* Compute the 1 byte/pix luma plane (kept alongside the RGB or JPEG
+     * buffer, which the poster still needs) and, in the same pass, a 64 bit
+     * difference hash of a 9x8 luma thumbnail, followed by the sharpness
+     * score on a sparse grid of the plane. JPEG frames are decoded to
+     * greyscale only, downscaled by the luma scale. Does nothing if already
+     * computed, returns false if the frame couldn't be decoded. */
+    bool compute_luma();
+
+    /* luma plane, nullptr until compute_luma() has been called */
+    const unsigned char* luma() const {
+      return (format_ == FrameFormat::GREY8) ? buffer_ : luma_;
+    }
+
+    /* luma plane dimensions, smaller than rows()/cols() for scaled JPEG
+     * decodes. Multiply luma coordinates by luma_scale() for frame ones. */
+    unsigned int luma_rows() const { return luma_rows_; }
+    unsigned int luma_cols() const { return luma_cols_; }
+    unsigned int luma_scale() const { return luma_scale_; }
+
+    /* request a DCT scaled luma decode (1, 2, 4 or 8) for JPEG frames,
+     * must be set before compute_luma() */
+    void set_luma_scale(unsigned int scale) {
+      if (format_ == FrameFormat::JPEG) { luma_scale_ = scale; }
+    }
+
+    /* perceptual hash, similar scenes differ in only a few bits */
+    uint64_t thumb_hash() const { return thumb_hash_; }
+
+    /* focus score of the luma plane (see sharpness.h), computed with it */
+    uint32_t sharpness() const { return sharpness_; }
+
     void convert_to_greyscale() {
       int tmp = 0;
-      if (format_ == FrameFormat::GREY8) return; // do nothing, already 1byte/pix = grey
+      if (format_ != FrameFormat::RGB24) return; // do nothing, already 1byte/pix = grey
       
       size_t new_bytes = (size_t)(rows()*cols());
       unsigned char* new_buf = new unsigned char[new_bytes];
@@ -70,11 +143,33 @@ class Frame {
     }
 
   protected:
+    size_t luma_bytes() const { return static_cast<size_t>(luma_rows_) * luma_cols_; }
+
+    void charge(size_t bytes) {
+      if (budget_ == nullptr) return;
+      budget_->charge(bytes);
+      charged_ += bytes;
+    }
+
     unsigned char* buffer_;
     size_t buf_length_;
     unsigned int rows_;
     unsigned int cols_;
     FrameFormat format_;
+    uint64_t id_;
+    unsigned int device_;
+    FrameClock::time_point timestamp_;
+    unsigned char* luma_;
+    unsigned int luma_rows_;
+    unsigned int luma_cols_;
+    unsigned int luma_scale_;
+    uint64_t thumb_hash_;
+    uint32_t sharpness_;
+    bool luma_done_;
+    MemoryBudget* budget_;
+    size_t charged_;
+
+    static std::atomic<uint64_t> next_id_;
 };
 
 #endif
@@ -0,0 +1,126 @@
+#include "frame_image.h"
+
+#include <algorithm>
+#include <memory>
+
+using namespace cimg_library;
+
+static const unsigned char GREEN[] = {0, 255, 0};
+static const unsigned char WHITE[] = {255};
+
+static const int CROP_MARGIN = 32; // pixels around the result points
+
+bool PayloadModeFromString(const std::string& s, PayloadMode& mode) {
+  if (s == "full") {
+    mode = PayloadMode::FULL;
+  } else if (s == "crop") {
+    mode = PayloadMode::CROP;
+  } else if (s == "thumbnail") {
+    mode = PayloadMode::THUMBNAIL;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+CImg<unsigned char> render_frame(const Frame& f, const ResultPoints& points,
+                                 unsigned int width) {
+  bool rgb = (f.format() == FrameFormat::RGB24);
+
+  CImg<unsigned char> img;
+  int scale = 1;
+
+  if (rgb) {
+    img = CImg<unsigned char>(f.buf(), 3, f.cols(), f.rows());
+    // CImg needs a different byte order
+    img.permute_axes("YZCX");
+  } else {
+    img = CImg<unsigned char>(f.luma(), f.luma_cols(), f.luma_rows());
+    scale = f.luma_scale(); // result points are in frame coordinates
+  }
+
+  for (auto& rp : points) {
+    img.draw_circle(rp.first / scale, rp.second / scale, 10 / scale + 1,
+                    rgb ? GREEN : WHITE);
+  }
+
+  if ((width > 0) && (static_cast<unsigned int>(img.width()) > width)) {
+    unsigned int height = img.height() * width / img.width();
+    img.resize(width, height, -100, -100, 1); // nearest neighbour, cheap
+  }
+
+  return img;
+}
+
+JpegPtr encode_jpeg(const CImg<unsigned char>& img, unsigned int quality) {
+  unsigned int size = img.size(); // raw size is an upper bound
+  std::unique_ptr<JOCTET[]> out(new JOCTET[size]);
+  img.save_jpeg_buffer(out.get(), size, quality);
+
+  return std::make_shared<const std::vector<unsigned char>>(out.get(),
+                                                            out.get() + size);
+}
+
+/* copy the bounding box of the result points (plus margin) into a new
+ * frame, RGB frames stay RGB, others are cropped from the luma plane */
+static FramePtr crop_frame(const Frame& f, ResultPoints& points,
+                           MemoryBudget* budget) {
+  bool rgb = (f.format() == FrameFormat::RGB24);
+  int scale = rgb ? 1 : f.luma_scale();
+  int w = rgb ? f.cols() : f.luma_cols();
+  int h = rgb ? f.rows() : f.luma_rows();
+  int bpp = rgb ? 3 : 1;
+  const unsigned char* src = rgb ? f.buf() : f.luma();
+
+  int x0 = w, y0 = h, x1 = 0, y1 = 0;
+  for (auto& rp : points) {
+    x0 = std::min(x0, rp.first / scale);
+    y0 = std::min(y0, rp.second / scale);
+    x1 = std::max(x1, rp.first / scale);
+    y1 = std::max(y1, rp.second / scale);
+  }
+
+  x0 = std::max(0, x0 - CROP_MARGIN);
+  y0 = std::max(0, y0 - CROP_MARGIN);
+  x1 = std::min(w, x1 + CROP_MARGIN);
+  y1 = std::min(h, y1 + CROP_MARGIN);
+
+  int cw = x1 - x0, ch = y1 - y0;
+  std::vector<unsigned char> buf(static_cast<size_t>(cw) * ch * bpp);
+  for (int y = 0; y < ch; y++) {
+    std::copy(src + (static_cast<size_t>(y0 + y) * w + x0) * bpp,
+              src + (static_cast<size_t>(y0 + y) * w + x1) * bpp,
+              buf.begin() + static_cast<size_t>(y) * cw * bpp);
+  }
+
+  // points relative to the crop, in its own (unscaled) pixels
+  for (auto& rp : points) {
+    rp.first = rp.first / scale - x0;
+    rp.second = rp.second / scale - y0;
+  }
+
+  auto crop = std::make_shared<Frame>(buf.data(), buf.size(), ch, cw,
+                                      rgb ? FrameFormat::RGB24 : FrameFormat::GREY8);
+  crop->set_id(f.id());
+  if (budget != nullptr) { crop->set_budget(budget); }
+  return crop;
+}
+
+ScanResult compact_result(const ScanResult& r, PayloadMode mode,
+                          unsigned int thumb_width, unsigned int quality,
+                          MemoryBudget* budget) {
+  if ((mode == PayloadMode::FULL) || (r.frame_ == nullptr) || r.jpeg_)
+    return r;
+
+  ScanResult c = r;
+
+  if ((mode == PayloadMode::CROP) && !r.result_points_.empty()) {
+    c.frame_ = crop_frame(*r.frame_, c.result_points_, budget);
+    return c;
+  }
+
+  c.jpeg_ = encode_jpeg(render_frame(*r.frame_, r.result_points_, thumb_width),
+                        quality);
+  c.frame_ = nullptr;
+  return c;
+}
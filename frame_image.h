@@ -0,0 +1,44 @@
+#ifndef FRAME_IMAGE_H_
+#define FRAME_IMAGE_H_
+
+#include "frame.h"
+#include "reader.h"
+
+#include <jpeglib.h>
+#include <jerror.h>
+#define cimg_plugin "plugins/jpeg_buffer.h"
+#include <CImg.h>
+
+#include <utility>
+#include <vector>
+
+using ResultPoints = std::vector<std::pair<int,int>>;
+
+/* Frame as an image with the result points (in frame coordinates) drawn
+ * in, downscaled to at most width pixels wide (0 keeps the size). Frames
+ * without RGB data render as greyscale from their luma plane. */
+cimg_library::CImg<unsigned char> render_frame(const Frame& f,
+                                               const ResultPoints& points,
+                                               unsigned int width);
+
+JpegPtr encode_jpeg(const cimg_library::CImg<unsigned char>& img,
+                    unsigned int quality);
+
+enum class PayloadMode {
+  FULL,     // keep a reference to the whole captured frame
+  CROP,     // copy of the region around the result points
+  THUMBNAIL // downscaled JPEG, encoded in the decode thread
+};
+
+// returns false for unknown names ("full", "crop", "thumbnail")
+bool PayloadModeFromString(const std::string& s, PayloadMode& mode);
+
+/* Replace the full frame held by a result with a crop around its result
+ * points or an encoded thumbnail, so a queued result costs kilobytes
+ * rather than a whole frame. Results without points are thumbnailed when
+ * cropping. */
+ScanResult compact_result(const ScanResult& r, PayloadMode mode,
+                          unsigned int thumb_width, unsigned int quality,
+                          MemoryBudget* budget);
+
+#endif
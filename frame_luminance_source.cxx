@@ -0,0 +1,109 @@
+#include "frame_luminance_source.h"
+
+#include "ByteArray.h"
+#include "GenericLuminanceSource.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+FrameLuminanceSource::FrameLuminanceSource(FramePtr frame):
+  FrameLuminanceSource(frame, 0, 0, frame->luma_cols(), frame->luma_rows()) {
+}
+
+FrameLuminanceSource::FrameLuminanceSource(FramePtr frame, int left, int top,
+                                           int width, int height):
+  frame_(frame),
+  left_(left),
+  top_(top),
+  width_(width),
+  height_(height),
+  stride_(frame->luma_cols()),
+  origin_(nullptr) {
+
+  if (frame_->luma() == nullptr)
+    throw std::invalid_argument("Frame has no luma plane");
+
+  if ((left < 0) || (top < 0) || (width <= 0) || (height <= 0) ||
+      (left + width > static_cast<int>(frame_->luma_cols())) ||
+      (top + height > static_cast<int>(frame_->luma_rows())))
+    throw std::invalid_argument("Crop rectangle outside of frame");
+
+  origin_ = frame_->luma() + static_cast<size_t>(top_) * stride_ + left_;
+}
+
+const uint8_t* FrameLuminanceSource::getRow(int y, ZXing::ByteArray& buffer,
+                                            bool forceCopy) const {
+  const uint8_t* row = origin_ + static_cast<size_t>(y) * stride_;
+
+  if (!forceCopy)
+    return row;
+
+  buffer.resize(width_);
+  std::memcpy(buffer.data(), row, width_);
+  return buffer.data();
+}
+
+const uint8_t* FrameLuminanceSource::getMatrix(ZXing::ByteArray& buffer,
+                                               int& outRowBytes,
+                                               bool forceCopy) const {
+  if (!forceCopy) {
+    outRowBytes = stride_;
+    return origin_;
+  }
+
+  buffer.resize(static_cast<size_t>(width_) * height_);
+  for (int y = 0; y < height_; y++) {
+    std::memcpy(buffer.data() + static_cast<size_t>(y) * width_,
+                origin_ + static_cast<size_t>(y) * stride_, width_);
+  }
+  outRowBytes = width_;
+  return buffer.data();
+}
+
+std::shared_ptr<ZXing::LuminanceSource> FrameLuminanceSource::cropped(
+    int left, int top, int width, int height) const {
+  // clamp like the ZXing sources do, callers may pass slightly oversized rects
+  left = std::max(0, left);
+  top = std::max(0, top);
+  width = std::min(width, width_ - left);
+  height = std::min(height, height_ - top);
+
+  return std::make_shared<FrameLuminanceSource>(frame_, left_ + left,
+                                                top_ + top, width, height);
+}
+
+std::shared_ptr<ZXing::LuminanceSource> FrameLuminanceSource::rotated(
+    int degreeCW) const {
+  degreeCW = ((degreeCW % 360) + 360) % 360;
+  if (degreeCW % 90 != 0)
+    throw std::invalid_argument("Rotation must be a multiple of 90 degrees");
+
+  if (degreeCW == 0) {
+    return std::make_shared<FrameLuminanceSource>(frame_, left_, top_, width_,
+                                                  height_);
+  }
+
+  bool swap = (degreeCW != 180);
+  int out_width = swap ? height_ : width_;
+  int out_height = swap ? width_ : height_;
+  std::vector<uint8_t> out(static_cast<size_t>(width_) * height_);
+
+  for (int y = 0; y < height_; y++) {
+    const uint8_t* row = origin_ + static_cast<size_t>(y) * stride_;
+    for (int x = 0; x < width_; x++) {
+      int ox, oy;
+      switch (degreeCW) {
+        case 90:  ox = height_ - 1 - y; oy = x; break;
+        case 180: ox = width_ - 1 - x;  oy = height_ - 1 - y; break;
+        default:  ox = y;               oy = width_ - 1 - x; break;
+      }
+      out[static_cast<size_t>(oy) * out_width + ox] = row[x];
+    }
+  }
+
+  // GenericLuminanceSource keeps its own copy of the grey buffer
+  return std::make_shared<ZXing::GenericLuminanceSource>(0, 0, out_width,
+      out_height, out.data(), out_width);
+}
@@ -0,0 +1,56 @@
+#ifndef FRAME_LUMINANCE_SOURCE_H_
+#define FRAME_LUMINANCE_SOURCE_H_
+
+#include "frame.h"
+
+#include "LuminanceSource.h"
+
+#include <memory>
+
+/* ZXing LuminanceSource over the luma plane of a Frame, without copying.
+ *
+ * getRow() and getMatrix() hand out pointers straight into the frame's
+ * luma plane (with the plane's stride for cropped views), only copying when
+ * ZXing forces it. The source holds the FramePtr, so the plane stays valid
+ * for as long as any binarizer or crop still references the source.
+ *
+ * The frame's luma plane must exist, see Frame::compute_luma(). Coordinates
+ * are in luma plane pixels, which differ from frame pixels for scaled JPEG
+ * decodes.
+ *
+ * rotated() can't be a view, it copies the (cropped) plane into a rotated
+ * buffer. ZXing only asks for it with try_rotate when the 1D readers found
+ * nothing horizontally, so the copy stays off the common path.
+ */
+class FrameLuminanceSource : public ZXing::LuminanceSource {
+  public:
+    explicit FrameLuminanceSource(FramePtr frame);
+    FrameLuminanceSource(FramePtr frame, int left, int top, int width,
+                         int height);
+
+    int width() const override { return width_; }
+    int height() const override { return height_; }
+
+    const uint8_t* getRow(int y, ZXing::ByteArray& buffer,
+                          bool forceCopy = false) const override;
+    const uint8_t* getMatrix(ZXing::ByteArray& buffer, int& outRowBytes,
+                             bool forceCopy = false) const override;
+
+    bool canCrop() const override { return true; }
+    std::shared_ptr<ZXing::LuminanceSource> cropped(int left, int top,
+        int width, int height) const override;
+
+    bool canRotate() const override { return true; }
+    std::shared_ptr<ZXing::LuminanceSource> rotated(
+        int degreeCW) const override;
+  private:
+    FramePtr frame_;
+    int left_;
+    int top_;
+    int width_;
+    int height_;
+    int stride_;
+    const uint8_t* origin_; // top left pixel of this view
+};
+
+#endif
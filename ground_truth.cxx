@@ -0,0 +1,104 @@
+#include "ground_truth.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+static const AccuracyStats NO_STATS = {0, 0, 0, 0, 0, 0,
+                                       std::chrono::microseconds{0},
+                                       std::chrono::microseconds{0}};
+
+GroundTruth::GroundTruth():
+  interval_(NO_STATS),
+  total_(NO_STATS),
+  started_(false) {
+}
+
+void GroundTruth::expect(uint64_t frame_id, const std::string& format,
+                         const std::string& text) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  expected_[frame_id] = Expected{format, text};
+}
+
+void GroundTruth::check(const ScanResult& r, std::chrono::microseconds latency) {
+  std::lock_guard<std::mutex> lk(mutex_);
+
+  auto now = std::chrono::steady_clock::now();
+  if (!started_) {
+    start_ = interval_start_ = now;
+    started_ = true;
+  }
+
+  auto it = expected_.find(r.frame_id_);
+  if (it == expected_.end())
+    return; // not a generated frame
+
+  // frames are decoded in order, older unchecked ones were dropped
+  unsigned long lost = std::distance(expected_.begin(), it);
+  const Expected e = it->second;
+  expected_.erase(expected_.begin(), ++it);
+
+  for (auto* s : {&interval_, &total_}) {
+    s->lost_ += lost;
+    s->frames_++;
+    s->latency_sum_ += latency;
+    s->latency_max_ = std::max(s->latency_max_, latency);
+
+    if (r.text_.empty()) {
+      if (e.text_.empty()) {
+        s->empty_++;
+      } else {
+        s->misses_++;
+      }
+    } else if ((r.text_ == e.text_) && (r.format_ == e.format_)) {
+      s->hits_++;
+    } else {
+      s->misreads_++;
+    }
+  }
+}
+
+void GroundTruth::lose(unsigned long frames) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  interval_.lost_ += frames;
+  total_.lost_ += frames;
+}
+
+void GroundTruth::expire_pending() {
+  std::lock_guard<std::mutex> lk(mutex_);
+  interval_.lost_ += expected_.size();
+  total_.lost_ += expected_.size();
+  expected_.clear();
+}
+
+size_t GroundTruth::pending() const {
+  std::lock_guard<std::mutex> lk(mutex_);
+  return expected_.size();
+}
+
+void GroundTruth::log_report(const char* label, bool reset) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  if (!started_) return;
+
+  if (reset) {
+    log_stats(label, interval_, interval_start_);
+    interval_ = NO_STATS;
+    interval_start_ = std::chrono::steady_clock::now();
+  } else {
+    log_stats(label, total_, start_);
+  }
+}
+
+void GroundTruth::log_stats(const char* label, const AccuracyStats& s,
+                            std::chrono::steady_clock::time_point since) const {
+  if (s.frames_ == 0) return;
+
+  auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - since).count();
+
+  spdlog::get("console")->info("{} frames {} ({:.1f} fps), hits {}, misses {}, "
+      "misreads {}, empty {}, lost {}, latency avg {}us max {}us", label,
+      s.frames_, elapsed_ms ? 1000.0 * s.frames_ / elapsed_ms : 0.0,
+      s.hits_, s.misses_, s.misreads_, s.empty_, s.lost_,
+      s.latency_sum_.count() / s.frames_, s.latency_max_.count());
+}
@@ -0,0 +1,65 @@
+#ifndef GROUND_TRUTH_H_
+#define GROUND_TRUTH_H_
+
+#include "reader.h"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+struct AccuracyStats {
+  unsigned long frames_;   // decoded frames checked against ground truth
+  unsigned long hits_;     // barcode read with the right text and format
+  unsigned long misses_;   // barcode present, nothing read
+  unsigned long misreads_; // wrong text or format, or a read of an empty frame
+  unsigned long empty_;    // empty frames correctly left unread
+  unsigned long lost_;     // generated but never decoded (dropped)
+  std::chrono::microseconds latency_sum_;
+  std::chrono::microseconds latency_max_;
+};
+
+/* What a generated frame contains, keyed by frame id, and how the decoder
+ * did on it. The source records, the decode thread checks. */
+class GroundTruth {
+  public:
+    GroundTruth();
+
+    // text empty = frame without a barcode
+    void expect(uint64_t frame_id, const std::string& format,
+                const std::string& text);
+
+    void check(const ScanResult& r, std::chrono::microseconds latency);
+
+    // frames generated but never queued for decoding
+    void lose(unsigned long frames);
+
+    // count frames still unchecked as lost, e.g. before the final report
+    void expire_pending();
+
+    // frames generated but not checked yet
+    size_t pending() const;
+
+    /* log accuracy, latency and throughput since the last reset (or since
+     * the first check for the totals) */
+    void log_report(const char* label, bool reset);
+  private:
+    struct Expected {
+      std::string format_;
+      std::string text_;
+    };
+
+    void log_stats(const char* label, const AccuracyStats& s,
+                   std::chrono::steady_clock::time_point since) const;
+
+    mutable std::mutex mutex_;
+    std::map<uint64_t, Expected> expected_;
+    AccuracyStats interval_;
+    AccuracyStats total_;
+    std::chrono::steady_clock::time_point interval_start_;
+    std::chrono::steady_clock::time_point start_;
+    bool started_;
+};
+
+#endif
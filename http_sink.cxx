@@ -0,0 +1,22 @@
+#include "http_sink.h"
+#include "log_limit.h"
+
+#include <spdlog/spdlog.h>
+#include <cpr/cpr.h>
+
+HttpSink::HttpSink(std::string url): url_(url) {
+}
+
+bool HttpSink::publish(const Payload& payload) {
+  auto post = cpr::Post(cpr::Url(url_),
+        cpr::Body{payload.data(), payload.size()},
+        cpr::Timeout{TIMEOUT_SECONDS * 1000});
+
+  if (!post.error.message.empty()) {
+    LOG_RATE_LIMITED(spdlog::get("console"), warn, 5000,
+                     "Could not post result: {}", post.error.message);
+    return false;
+  }
+
+  return true;
+}
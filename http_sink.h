@@ -0,0 +1,21 @@
+#ifndef HTTP_SINK_H_
+#define HTTP_SINK_H_
+
+#include "result_sink.h"
+
+#include <string>
+
+static const int TIMEOUT_SECONDS = 1;
+
+/* POSTs each payload to a URL (the original zxwebcam output) */
+class HttpSink : public ResultSink {
+  public:
+    explicit HttpSink(std::string url);
+
+    std::string name() const override { return url_; }
+    bool publish(const Payload& payload) override;
+  private:
+    std::string url_;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "jpeg_luma.h"
+
+#include <cstdio>
+#include <csetjmp>
+
+#include <jpeglib.h>
+#include <jerror.h>
+
+namespace {
+
+struct ErrorManager {
+  jpeg_error_mgr pub_;
+  jmp_buf jump_;
+};
+
+void error_exit(j_common_ptr cinfo) {
+  // libjpeg's default handler calls exit(), unwind back to the decoder
+  longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump_, 1);
+}
+
+void output_message(j_common_ptr) {
+  // corrupt webcam frames are common, don't spam stderr
+}
+
+}
+
+unsigned char* decode_jpeg_luma(const unsigned char* data, size_t length,
+                                unsigned int scale_denom,
+                                unsigned int& width, unsigned int& height) {
+  jpeg_decompress_struct cinfo;
+  ErrorManager err;
+
+  // volatile, it's modified between setjmp and a possible longjmp
+  unsigned char* volatile plane = nullptr;
+
+  cinfo.err = jpeg_std_error(&err.pub_);
+  err.pub_.error_exit = error_exit;
+  err.pub_.output_message = output_message;
+
+  if (setjmp(err.jump_)) {
+    jpeg_destroy_decompress(&cinfo);
+    delete[] plane;
+    return nullptr;
+  }
+
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, const_cast<unsigned char*>(data), length);
+
+  // MJPEG frames often omit the Huffman tables, libjpeg-turbo substitutes
+  // the standard ones from the JPEG spec in that case
+  jpeg_read_header(&cinfo, TRUE);
+
+  cinfo.out_color_space = JCS_GRAYSCALE;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = scale_denom;
+  cinfo.dct_method = JDCT_IFAST;
+  cinfo.do_fancy_upsampling = FALSE;
+
+  jpeg_start_decompress(&cinfo);
+
+  width = cinfo.output_width;
+  height = cinfo.output_height;
+  plane = new unsigned char[static_cast<size_t>(width) * height];
+
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = plane + static_cast<size_t>(cinfo.output_scanline) * width;
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+
+  return plane;
+}
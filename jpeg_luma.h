@@ -0,0 +1,17 @@
+#ifndef JPEG_LUMA_H_
+#define JPEG_LUMA_H_
+
+#include <cstddef>
+
+/* Decode only the luma channel of a JPEG image.
+ *
+ * Uses libjpeg's greyscale output, so chroma is never upsampled or
+ * converted, and DCT scaling by 1/scale_denom (1, 2, 4 or 8) so smaller
+ * outputs skip most of the IDCT work. Returns a new[] allocated plane of
+ * width x height bytes, or nullptr if the data couldn't be decoded.
+ */
+unsigned char* decode_jpeg_luma(const unsigned char* data, size_t length,
+                                unsigned int scale_denom,
+                                unsigned int& width, unsigned int& height);
+
+#endif
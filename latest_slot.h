@@ -0,0 +1,66 @@
+#ifndef LATEST_SLOT_H_
+#define LATEST_SLOT_H_
+
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+/* Single item mailbox with latest-wins semantics.
+ *
+ * put() overwrites whatever hasn't been taken yet, so a slow consumer
+ * always gets the most recent item and never builds up a backlog.
+ */
+
+template<typename T>
+class LatestSlot {
+  public:
+    LatestSlot(): full_{false}, closed_{false} {};
+    virtual ~LatestSlot() {};
+
+    void put(T p) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      data_ = p;
+      full_ = true;
+      cond_.notify_one();
+    };
+
+    /* returns T() once the slot has been closed */
+    T wait_and_take() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while(!full_ && !closed_) {
+        cond_.wait(lock);
+      }
+
+      if (closed_) { return T(); }
+
+      full_ = false;
+      T p = data_;
+      data_ = T();
+      return p;
+    };
+
+    /* wait until deadline (or close), keeping any item in the slot */
+    void wait_until(std::chrono::steady_clock::time_point deadline) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while(!closed_) {
+        if (cond_.wait_until(lock, deadline) == std::cv_status::timeout) {
+          return;
+        }
+      }
+    };
+
+    /* wake all waiting consumers, used on shutdown */
+    void close() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+      cond_.notify_all();
+    };
+  protected:
+    std::mutex mutex_;
+    T data_;
+    bool full_;
+    bool closed_;
+    std::condition_variable cond_;
+};
+
+#endif
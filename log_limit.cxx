@@ -0,0 +1,28 @@
+#include "log_limit.h"
+
+static int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LogRateLimit::LogRateLimit(std::chrono::milliseconds interval):
+  interval_ns_(std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count()),
+  next_ns_{0},
+  suppressed_{0} {
+}
+
+bool LogRateLimit::allow(unsigned long& suppressed) {
+  int64_t now = now_ns();
+  int64_t next = next_ns_.load(std::memory_order_relaxed);
+
+  // only one of several racing threads wins the slot
+  if ((now < next) ||
+      !next_ns_.compare_exchange_strong(next, now + interval_ns_,
+                                        std::memory_order_relaxed)) {
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+  return true;
+}
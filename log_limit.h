@@ -0,0 +1,53 @@
+#ifndef LOG_LIMIT_H_
+#define LOG_LIMIT_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <spdlog/spdlog.h>
+
+/* Lets through at most one message per interval, counting the rest.
+ * Lock free, a call site may be shared by several threads. */
+class LogRateLimit {
+  public:
+    explicit LogRateLimit(std::chrono::milliseconds interval);
+
+    /* true if a message may be logged now, suppressed is then set to the
+     * number of messages held back since the last one */
+    bool allow(unsigned long& suppressed);
+  private:
+    const int64_t interval_ns_;
+    std::atomic<int64_t> next_ns_;
+    std::atomic<unsigned long> suppressed_;
+};
+
+/* Rate limited logging for paths that can fire per frame, e.g.
+ *
+ *   LOG_RATE_LIMITED(logger, warn, 5000, "Frame queue full on {}", dev);
+ *
+ * logs at most once per interval_ms per call site and appends how many
+ * messages were suppressed meanwhile. Arguments are only formatted when
+ * the message is logged. */
+#define LOG_RATE_LIMITED(logger, level, interval_ms, ...) \
+  do { \
+    static LogRateLimit log_limit_(std::chrono::milliseconds{interval_ms}); \
+    LOG_LIMITED_BY(log_limit_, logger, level, __VA_ARGS__); \
+  } while (0)
+
+/* Same with a limiter owned by the caller, for call sites shared by several
+ * sources that should be limited independently (e.g. one per device). */
+#define LOG_LIMITED_BY(limit, logger, level, ...) \
+  do { \
+    unsigned long log_suppressed_ = 0; \
+    if ((limit).allow(log_suppressed_)) { \
+      if (log_suppressed_ > 0) { \
+        (logger)->level("{} ({} similar suppressed)", \
+                        fmt::format(__VA_ARGS__), log_suppressed_); \
+      } else { \
+        (logger)->level(__VA_ARGS__); \
+      } \
+    } \
+  } while (0)
+
+#endif
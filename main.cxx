@@ -1,26 +1,46 @@
 #include "webcam.h"
 #include "reader.h"
 #include "webcam_thread.h"
+#include "synthetic_thread.h"
 #include "decode_thread.h"
 #include "poster_thread.h"
+#include "preview_thread.h"
+#include "mjpeg_server.h"
 #include "threadsafe_queue.h"
+#include "shutdown.h"
+#include "backpressure.h"
+#include "thread_placement.h"
+#include "trace.h"
 
 #include <spdlog/spdlog.h>
 #include <args.hxx>
 
-#include <atomic>
 #include <thread>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <system_error>
+#include <stdexcept>
 #include <signal.h>
+#include <sched.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
 #include <iostream>
 
-// global flag to exit all threads - set by sighandle
-std::atomic_bool exit_flag;
-
-static void handle_signals(int signum);
+static void wait_for_shutdown(int signal_fd, Shutdown& shutdown);
 static void process_barcode_format_flag(args::Flag& f,
                                         std::vector<std::string>& v);
 
+// power of 2, messages beyond it are dropped
+static const size_t LOG_QUEUE_SIZE = 4096;
+
 int main(int argc, char** argv) {
+  // format on the calling thread, write from spdlog's worker; a full queue
+  // discards instead of blocking the capture and decode threads
+  spdlog::set_async_mode(LOG_QUEUE_SIZE,
+                         spdlog::async_overflow_policy::discard_log_msg,
+                         nullptr, std::chrono::seconds{1});
   auto console = spdlog::stdout_color_mt("console");
 
   args::ArgumentParser parser("Barcode reader for webcams",
@@ -29,13 +49,122 @@ int main(int argc, char** argv) {
   args::HelpFlag help(parser, "help", "show help", {'h', "help"});
   
   args::Positional<std::string> url(parser, "url", "URL for POSTing results", "");
-  args::Positional<std::string> device(parser, "device", "V4L capture device",
-                                       "/dev/video0");
+  args::PositionalList<std::string> devices(parser, "devices",
+      "V4L capture devices (default /dev/video0)");
 
   args::ValueFlag<int> res_x(parser, "cap_width", "webcam x pixels", {'x'});
   args::ValueFlag<int> res_y(parser, "cap_height", "webcam y pixels", {'y'});
   args::ValueFlag<int> fps(parser, "fps", "webcam capture framerate", {'r'});
 
+  args::Flag adaptive(parser, "adaptive",
+      "adapt capture rate and resolution to decode load", {"adaptive"});
+  args::ValueFlag<unsigned int> latency_high(parser, "ms",
+      "decode latency that triggers load shedding (default 250)",
+      {"latency-high"});
+  args::ValueFlag<unsigned int> latency_low(parser, "ms",
+      "decode latency below which capture quality is restored (default 100)",
+      {"latency-low"});
+
+  args::ValueFlag<int> capture_cpu(parser, "cpu",
+      "pin the capture thread to a core", {"capture-cpu"});
+  args::ValueFlag<int> decode_cpu(parser, "cpu",
+      "pin the decode thread to a core", {"decode-cpu"});
+  args::ValueFlag<int> poster_cpu(parser, "cpu",
+      "pin the poster, preview and http threads to a core", {"poster-cpu"});
+  args::ValueFlag<int> capture_prio(parser, "prio",
+      "real-time priority for the capture thread (needs CAP_SYS_NICE)",
+      {"capture-rt-prio"});
+  args::ValueFlag<std::string> rt_policy(parser, "policy",
+      "real-time policy for --capture-rt-prio, fifo, rr or other (default fifo)",
+      {"rt-policy"});
+
+  args::ValueFlagList<std::string> sink_args(parser, "sink",
+      "additional result output: uri[,queue=N][,drop=oldest|newest] with "
+      "uri one of http://..., tcp://host:port, unix:///path, shm://name",
+      {"sink"});
+
+  args::Flag cache(parser, "cache",
+      "reuse the previous decode for frames that look unchanged", {"cache"});
+  args::ValueFlag<unsigned int> cache_distance(parser, "bits",
+      "max differing thumbnail hash bits for a cache hit (default 4)",
+      {"cache-distance"});
+  args::ValueFlag<unsigned int> cache_age(parser, "ms",
+      "max age of a cached decode (default 1000)", {"cache-age"});
+
+  args::ValueFlag<std::string> binarizer(parser, "mode",
+      "binarizer: global, hybrid or adaptive (default hybrid)",
+      {"binarizer"});
+
+  args::ValueFlag<std::string> consensus(parser, "K/N[/ms]",
+      "only post 1D reads once K of the last N reads of a code agree "
+      "(within ms, default 1000)", {"consensus"});
+  args::ValueFlagList<std::string> consensus_format(parser,
+      "FORMAT=K/N[/ms]", "consensus rule for one format, e.g. QR_CODE=2/3",
+      {"consensus-format"});
+  args::Flag no_try_harder(parser, "no-try-harder",
+      "cheaper, less thorough decode, best combined with --consensus",
+      {"no-try-harder"});
+
+  args::ValueFlag<std::string> scanlines(parser, "N[/band]",
+      "read horizontal 1D codes from N scanlines (each averaging band rows) "
+      "first, full frame decode only on a near miss", {"scanlines"});
+
+  args::Flag adaptive_formats(parser, "adaptive-formats",
+      "try formats in order of recent hit rate, demote ones that stopped "
+      "reading", {"adaptive-formats"});
+  args::ValueFlag<unsigned int> demote_after(parser, "seconds",
+      "demote formats without a read for this long while others read, "
+      "0 = never (default 60)", {"demote-after"});
+  args::ValueFlag<unsigned int> demoted_retry(parser, "n",
+      "still try demoted formats on every nth frame (default 10)",
+      {"demoted-retry"});
+
+  args::Flag mjpeg(parser, "mjpeg",
+      "capture MJPEG, decode greyscale only and post the camera's JPEG",
+      {"mjpeg"});
+  args::ValueFlag<unsigned int> mjpeg_scale(parser, "denom",
+      "decode MJPEG at 1/denom resolution for scanning: 1, 2, 4 or 8",
+      {"mjpeg-scale"});
+
+  args::ValueFlag<unsigned int> preview_fps(parser, "fps",
+      "max preview frames rendered per second (default 5)", {"preview-fps"});
+  args::ValueFlag<unsigned int> preview_width(parser, "pixels",
+      "preview width (default 320)", {"preview-width"});
+  args::ValueFlag<unsigned int> preview_quality(parser, "quality",
+      "JPEG quality of posted previews (default 50)", {"preview-quality"});
+  args::ValueFlag<unsigned int> preview_post(parser, "ms",
+      "post a preview this often, 0 disables (default 1000)",
+      {"preview-post-ms"});
+
+  args::ValueFlag<unsigned int> memory_budget(parser, "MiB",
+      "soft limit on memory held by frames and results, 0 = none (default 0)",
+      {"memory-budget"});
+  args::ValueFlag<std::string> result_payload(parser, "mode",
+      "image kept with queued results: full, crop or thumbnail (default full)",
+      {"result-payload"});
+  args::ValueFlag<unsigned int> thumb_width(parser, "pixels",
+      "width of thumbnail result images (default 320)", {"thumbnail-width"});
+
+  args::ValueFlag<unsigned int> http_port(parser, "port",
+      "serve an MJPEG preview stream on this port (/stream, /snapshot.jpg)",
+      {"http-port"});
+  args::ValueFlag<std::string> http_address(parser, "address",
+      "listen address for --http-port (default 0.0.0.0)", {"http-address"});
+
+  args::Flag synthetic(parser, "synthetic",
+      "decode generated barcodes of the selected formats instead of "
+      "capturing, and report accuracy", {"synthetic"});
+  args::ValueFlag<std::string> synthetic_opts(parser, "key=val,...",
+      "synthetic frames: size, rotate, blur, noise, contrast, empty, fps "
+      "(0 = unlimited), frames, variants, seed", {"synthetic-opts"});
+
+  args::ValueFlag<std::string> trace_file(parser, "file",
+      "record per-frame spans, written as Chrome trace JSON on exit",
+      {"trace"});
+  args::ValueFlag<unsigned int> trace_events(parser, "count",
+      "trace events kept per thread, oldest are overwritten (default 65536)",
+      {"trace-events"});
+
   args::Flag verbose(parser, "verbose", "verbose log output", {'v'});
   args::Flag preview(parser, "preview", "preview video", {'p'});
   args::Group group(parser, "select barcode types to attempt decoding",
@@ -73,45 +202,282 @@ int main(int argc, char** argv) {
   process_barcode_format_flag(fmt_ean13, formats);
   process_barcode_format_flag(fmt_qr, formats);
 
-  WebcamSetup ws {args::get(device), 640, 480, 5};
+  WebcamSetup ws {args::get(devices), 640, 480, 5, static_cast<bool>(mjpeg), 1};
+  if (ws.devices_.empty()) { ws.devices_.push_back("/dev/video0"); }
 
   if (res_x) { ws.res_x_ = args::get(res_x); }
   if (res_y) { ws.res_y_ = args::get(res_y); }
   if (fps)   { ws.fps_   = args::get(fps);   }
+  if (mjpeg_scale) {
+    ws.luma_scale_ = args::get(mjpeg_scale);
+    if ((ws.luma_scale_ == 0) || (ws.luma_scale_ > 8) ||
+        (ws.luma_scale_ & (ws.luma_scale_ - 1))) {
+      std::cerr << "--mjpeg-scale must be 1, 2, 4 or 8" << std::endl;
+      return 1;
+    }
+  }
   if (verbose) { console->set_level(spdlog::level::debug); }
   
-  DecoderSetup ds {formats, static_cast<bool>(preview), ws.res_x_, ws.res_y_};
+  std::vector<SinkSetup> sinks;
+  try {
+    if (!args::get(url).empty()) {
+      auto u = args::get(url);
+      // the positional url has always been HTTP, scheme optional
+      if (u.find("://") == std::string::npos) { u = "http://" + u; }
+      sinks.push_back(parse_sink_setup(u));
+    }
+    for (auto& s : args::get(sink_args)) {
+      sinks.push_back(parse_sink_setup(s));
+    }
+  } catch (const std::invalid_argument& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  ResultCacheSetup rcs {static_cast<bool>(cache), 4,
+                        std::chrono::milliseconds{1000}};
+  if (cache_distance) { rcs.max_distance_ = args::get(cache_distance); }
+  if (cache_age) { rcs.max_age_ = std::chrono::milliseconds{args::get(cache_age)}; }
+
+  BinarizerMode bm = BinarizerMode::HYBRID;
+  if (binarizer && !BinarizerModeFromString(args::get(binarizer), bm)) {
+    std::cerr << "Unknown binarizer " << args::get(binarizer) << std::endl;
+    return 1;
+  }
+
+  PreviewSetup ps {static_cast<bool>(preview), 5, 320, 50, 1000};
+  if (preview_fps)     { ps.fps_     = args::get(preview_fps);     }
+  if (preview_width)   { ps.width_   = args::get(preview_width);   }
+  if (preview_quality) { ps.quality_ = args::get(preview_quality); }
+  if (preview_post)    { ps.post_interval_ms_ = args::get(preview_post); }
+
+  MjpegServerSetup ms {"0.0.0.0", 0};
+  if (http_port)    { ms.port_    = args::get(http_port);    }
+  if (http_address) { ms.address_ = args::get(http_address); }
+
+  bool feed_preview = ps.display_ || (ps.post_interval_ms_ > 0) ||
+                      (ms.port_ > 0);
+
+  SyntheticSetup ss {formats, ws.res_x_, ws.res_y_, 200, 0, 0, 0, 1, 0, 0, 0,
+                     32, 1};
+  if (synthetic || synthetic_opts) {
+    try {
+      if (synthetic_opts)
+        parse_synthetic_setup(args::get(synthetic_opts), ss);
+      validate_synthetic_setup(ss);
+    } catch (const std::invalid_argument& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
+  GroundTruth truth;
+
+  ConsensusSetup cs {static_cast<bool>(consensus) || consensus_format,
+                     {1, 1, std::chrono::milliseconds{1000}},
+                     {1, 1, std::chrono::milliseconds{1000}}, {}};
+  try {
+    if (consensus) { cs.linear_ = parse_consensus_rule(args::get(consensus)); }
+    for (auto& c : args::get(consensus_format)) {
+      parse_consensus_override(c, cs);
+    }
+  } catch (const std::invalid_argument& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  ScanlineSetup sls {0, 1};
+  if (scanlines && !ScanlineSetupFromString(args::get(scanlines), sls)) {
+    std::cerr << "--scanlines must be N or N/band, N from 1 to "
+              << MAX_SCANLINES << std::endl;
+    return 1;
+  }
 
+  FormatOrderSetup fos {static_cast<bool>(adaptive_formats),
+                        std::chrono::seconds{60}, 10};
+  if (demote_after)  { fos.demote_after_ = std::chrono::seconds{args::get(demote_after)}; }
+  if (demoted_retry) { fos.retry_every_ = std::max(1u, args::get(demoted_retry)); }
+
+  DecoderSetup ds {formats, feed_preview, rcs, bm, !no_try_harder, sls, fos, cs,
+                   PayloadMode::FULL, 320, synthetic ? &truth : nullptr};
+  if (result_payload &&
+      !PayloadModeFromString(args::get(result_payload), ds.payload_)) {
+    std::cerr << "Unknown result payload " << args::get(result_payload)
+              << std::endl;
+    return 1;
+  }
+  if (thumb_width) { ds.thumb_width_ = args::get(thumb_width); }
+
+  size_t budget_mib = memory_budget ? args::get(memory_budget) : 0;
+
+  // shed load well before the capture loop's hard queue limit (fps frames
+  // per camera)
+  const unsigned int cam_count = static_cast<unsigned int>(ws.devices_.size());
+  BackpressureSetup bs {static_cast<bool>(adaptive), 250, 100,
+                        std::max(1u, ws.fps_ * cam_count / 2), 2, 8};
+  if (latency_high) { bs.high_latency_ms_ = args::get(latency_high); }
+  if (latency_low)  { bs.low_latency_ms_  = args::get(latency_low);  }
+
+  BackpressureController controller(bs);
+
+  ThreadPlacement capture_tp {"zxw-capture", -1, SchedPolicy::OTHER, 0};
+  ThreadPlacement decode_tp {"zxw-decode", -1, SchedPolicy::OTHER, 0};
+  ThreadPlacement poster_tp {"zxw-poster", -1, SchedPolicy::OTHER, 0};
+  ThreadPlacement preview_tp {"zxw-preview", -1, SchedPolicy::OTHER, 0};
+  ThreadPlacement server_tp {"zxw-http", -1, SchedPolicy::OTHER, 0};
+
+  if (capture_cpu) { capture_tp.cpu_ = args::get(capture_cpu); }
+  if (decode_cpu)  { decode_tp.cpu_  = args::get(decode_cpu);  }
+  if (poster_cpu)  {
+    poster_tp.cpu_  = args::get(poster_cpu);
+    preview_tp.cpu_ = args::get(poster_cpu);
+    server_tp.cpu_  = args::get(poster_cpu);
+  }
+  for (int cpu : {capture_tp.cpu_, decode_tp.cpu_, poster_tp.cpu_}) {
+    if (cpu < -1 || cpu >= CPU_SETSIZE) {
+      std::cerr << "cpu " << cpu << " out of range, expected 0 to "
+                << CPU_SETSIZE - 1 << std::endl;
+      return 1;
+    }
+  }
+  if (capture_prio) {
+    capture_tp.policy_ = SchedPolicy::FIFO;
+    if (rt_policy && !SchedPolicyFromString(args::get(rt_policy),
+                                            capture_tp.policy_)) {
+      std::cerr << "Unknown scheduling policy " << args::get(rt_policy)
+                << std::endl;
+      return 1;
+    }
+    capture_tp.priority_ = args::get(capture_prio);
+  }
+
+  // outlives the queues, frames give their charge back when destroyed
+  MemoryBudget budget(budget_mib << 20);
   ThreadsafeQueue<FramePtr> frame_queue;
   ThreadsafeQueue<ScanResult> result_queue;
+  LatestSlot<ScanResult> preview_slot;
 
-  exit_flag = false;
-  
-  // insert signal handlers
-  struct sigaction sa = {};
-  sa.sa_handler = handle_signals;
+  // block SIGTERM/SIGINT in all threads (the mask is inherited), they are
+  // delivered through a signalfd that the main thread waits on instead
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGTERM);
+  sigaddset(&sigs, SIGINT);
+
+  if (pthread_sigmask(SIG_BLOCK, &sigs, NULL) != 0) {
+    console->error("Could not block signals <{}>", errno);
+    return -1;
+  }
+
+  int signal_fd = signalfd(-1, &sigs, SFD_CLOEXEC);
+  if (signal_fd == -1) {
+    console->error("Could not create signalfd <{}>", errno);
+    return -1;
+  }
 
-  if (( sigaction(SIGTERM, &sa, NULL) < 0 ) ||
-      ( sigaction(SIGINT , &sa, NULL) < 0 )) {
-    console->error("Could not insert signal handlers <{}>", errno);
+  if (trace_file) {
+#ifdef ZXWEBCAM_TRACING
+    trace_start(trace_events ? args::get(trace_events) : 65536);
+#else
+    console->warn("Not compiled with ZXWEBCAM_TRACING - cannot trace");
+#endif
+  }
+
+  std::unique_ptr<Shutdown> shutdown;
+  std::unique_ptr<MjpegFeed> feed;
+  try {
+    shutdown.reset(new Shutdown());
+    feed.reset(new MjpegFeed());
+  } catch (const std::system_error& e) {
+    console->error("{}", e.what());
     return -1;
   }
 
-  std::thread wt(webcam_thread, ws, std::ref(frame_queue), std::ref(exit_flag)); 
+  std::thread wt;
+  if (synthetic) {
+    wt = std::thread(synthetic_thread, ss, std::ref(frame_queue),
+                     std::ref(truth), std::ref(budget), std::ref(*shutdown));
+  } else {
+    wt = std::thread(webcam_thread, ws, std::ref(frame_queue),
+                     std::ref(controller), std::ref(budget),
+                     std::ref(*shutdown));
+  }
   std::thread dt(decode_thread, ds, std::ref(frame_queue),
                  std::ref(result_queue),
-                 std::ref(exit_flag));
-  std::thread pt(poster_thread, args::get(url), std::ref(result_queue),
-                 std::ref(exit_flag));
+                 std::ref(preview_slot),
+                 std::ref(controller), std::ref(budget),
+                 std::ref(*shutdown));
+  std::thread pt(poster_thread, sinks, std::ref(result_queue),
+                 std::ref(budget), std::ref(*shutdown));
+  std::thread vt(preview_thread, ps, std::ref(preview_slot),
+                 std::ref(result_queue), std::ref(*feed), std::ref(*shutdown));
+  std::thread ht;
+  if (ms.port_ > 0) {
+    ht = std::thread(mjpeg_server_thread, ms, std::ref(*feed),
+                     std::ref(*shutdown));
+  }
+
+  console->info("Thread placement {}", apply_thread_placement(wt, capture_tp));
+  console->info("Thread placement {}", apply_thread_placement(dt, decode_tp));
+  console->info("Thread placement {}", apply_thread_placement(pt, poster_tp));
+  console->info("Thread placement {}", apply_thread_placement(vt, preview_tp));
+  if (ht.joinable()) {
+    console->info("Thread placement {}", apply_thread_placement(ht, server_tp));
+  }
+
+  wait_for_shutdown(signal_fd, *shutdown);
+
+  // wake everything blocked on a queue
+  frame_queue.close();
+  result_queue.close();
+  preview_slot.close();
 
   wt.join();
   dt.join();
   pt.join();
+  vt.join();
+  if (ht.joinable()) { ht.join(); }
+
+  if (synthetic) {
+    // whatever the decoder didn't get to before shutdown is lost
+    truth.expire_pending();
+    truth.log_report("synthetic total", false);
+  }
+
+  if (trace_enabled()) {
+    try {
+      trace_write(args::get(trace_file));
+      console->info("Trace written to {}", args::get(trace_file));
+    } catch (const std::system_error& e) {
+      console->error("{}", e.what());
+    }
+  }
+
+  close(signal_fd);
+
+  // flush what's still queued
+  spdlog::drop_all();
 }
 
-void handle_signals(int signum) {
-  std::cerr << "SIGNAL SIGTERM/SIGINT " << signum <<  ": EXITING" << std::endl;
-  exit_flag = true;
+/* Block until either a signal arrives or one of the threads requests
+ * shutdown (e.g. on a device error). */
+static void wait_for_shutdown(int signal_fd, Shutdown& shutdown) {
+  pollfd fds[2] = {{signal_fd, POLLIN, 0}, {shutdown.fd(), POLLIN, 0}};
+
+  while (!shutdown.requested()) {
+    int r = poll(fds, 2, -1);
+    if ((r == -1) && (errno == EINTR))
+      continue;
+
+    if (fds[0].revents & POLLIN) {
+      signalfd_siginfo info = {};
+      if (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        std::cerr << "SIGNAL SIGTERM/SIGINT " << info.ssi_signo
+                  << ": EXITING" << std::endl;
+      }
+    }
+
+    shutdown.request();
+  }
 }
 
 static void process_barcode_format_flag(args::Flag& f,
@@ -0,0 +1,19 @@
+#include "memory_budget.h"
+
+MemoryBudget::MemoryBudget(size_t limit):
+  limit_{limit},
+  used_{0},
+  peak_{0} {
+}
+
+void MemoryBudget::charge(size_t bytes) {
+  size_t now = (used_ += bytes);
+
+  size_t peak = peak_;
+  while ((now > peak) && !peak_.compare_exchange_weak(peak, now)) {
+  }
+}
+
+void MemoryBudget::release(size_t bytes) {
+  used_ -= bytes;
+}
@@ -0,0 +1,37 @@
+#ifndef MEMORY_BUDGET_H_
+#define MEMORY_BUDGET_H_
+
+#include <atomic>
+#include <cstddef>
+
+/* Pipeline-wide accounting of frame and result memory.
+ *
+ * Frames charge their buffers from capture until the last reference goes
+ * away, encoded payloads are charged while the sinks hold them. Stages
+ * check exceeded() before adding work: capture skips frames at the source
+ * and decode compacts results to thumbnails. Payloads are only accounted,
+ * the sink queues bound them.
+ * The limit is soft, a check and the following charge aren't atomic.
+ */
+class MemoryBudget {
+  public:
+    explicit MemoryBudget(size_t limit); // 0 = unlimited
+
+    void charge(size_t bytes);
+    void release(size_t bytes);
+
+    // true if adding bytes would go over the limit
+    bool exceeded(size_t bytes = 0) const {
+      return (limit_ > 0) && (used_ + bytes > limit_);
+    }
+
+    size_t used() const { return used_; }
+    size_t peak() const { return peak_; }
+    size_t limit() const { return limit_; }
+  private:
+    const size_t limit_;
+    std::atomic<size_t> used_;
+    std::atomic<size_t> peak_;
+};
+
+#endif
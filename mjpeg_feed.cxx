@@ -0,0 +1,46 @@
+#include "mjpeg_feed.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+MjpegFeed::MjpegFeed(): fd_{-1}, wanted_{0} {
+  fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if (fd_ == -1) {
+    throw std::system_error(errno, std::generic_category(),
+            "Unable to create mjpeg feed eventfd");
+  }
+}
+
+MjpegFeed::~MjpegFeed() {
+  if (fd_ != -1) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+void MjpegFeed::publish(JpegPtr jpeg) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    latest_ = jpeg;
+  }
+
+  uint64_t one = 1;
+  ssize_t r = write(fd_, &one, sizeof(one));
+  (void)r; // counter saturating just means the server is already notified
+}
+
+JpegPtr MjpegFeed::latest() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return latest_;
+}
+
+void MjpegFeed::clear_notification() {
+  uint64_t count = 0;
+  ssize_t r = read(fd_, &count, sizeof(count));
+  (void)r;
+}
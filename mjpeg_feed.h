@@ -0,0 +1,38 @@
+#ifndef MJPEG_FEED_H_
+#define MJPEG_FEED_H_
+
+#include "reader.h"
+
+#include <atomic>
+#include <mutex>
+
+/* Hand-off of encoded preview frames from preview_thread to the MJPEG
+ * server. Only the latest frame is kept, each is encoded once and shared
+ * by all connected clients.
+ */
+class MjpegFeed {
+  public:
+    MjpegFeed(); // throws std::system_error if the eventfd can't be created
+    ~MjpegFeed();
+
+    MjpegFeed(const MjpegFeed&) = delete;
+    MjpegFeed& operator=(const MjpegFeed&) = delete;
+
+    // preview thread: true while any client is waiting for frames, so
+    // nothing is rendered for a server nobody watches
+    bool wanted() const { return wanted_ > 0; }
+    void publish(JpegPtr jpeg);
+
+    // server thread
+    JpegPtr latest() const;
+    void set_wanted(int clients) { wanted_ = clients; }
+    int fd() const { return fd_; } // readable after publish()
+    void clear_notification();
+  private:
+    int fd_;
+    std::atomic_int wanted_;
+    mutable std::mutex mutex_;
+    JpegPtr latest_;
+};
+
+#endif
@@ -0,0 +1,357 @@
+#include "mjpeg_server.h"
+
+#include <spdlog/spdlog.h>
+
+#include <map>
+#include <vector>
+#include <stdexcept>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+static const uint64_t SHUTDOWN_TOKEN = UINT64_MAX;
+static const uint64_t FEED_TOKEN = UINT64_MAX - 1;
+static const uint64_t LISTEN_TOKEN = UINT64_MAX - 2;
+
+static const int MAX_EVENTS = 16;
+static const size_t MAX_REQUEST = 4096;
+
+static const char BOUNDARY[] = "zxwebcamframe";
+
+struct Client {
+  std::string request_;   // bytes received until the header is complete
+  bool streaming_;        // /stream client, gets every frame it can keep up with
+  bool awaiting_frame_;   // /snapshot.jpg client waiting for the next frame
+  bool close_after_send_;
+
+  // current response: head_ + body_ + tail_, sent_ bytes of which are out
+  std::string head_;
+  JpegPtr body_;
+  std::string tail_;
+  size_t sent_;
+
+  JpegPtr pending_; // newest frame not yet started, replaced by newer ones
+
+  size_t length() const {
+    return head_.size() + (body_ ? body_->size() : 0) + tail_.size();
+  }
+  bool busy() const { return sent_ < length(); }
+};
+
+static void epoll_set(int epfd, int op, int fd, uint64_t token, uint32_t events) {
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.u64 = token;
+
+  if (-1 == epoll_ctl(epfd, op, fd, &ev)) {
+    throw std::system_error(errno, std::generic_category(),
+            "Unable to update epoll set");
+  }
+}
+
+static int listen_socket(const MjpegServerSetup& ms) {
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(ms.port_);
+  if (inet_pton(AF_INET, ms.address_.c_str(), &addr.sin_addr) != 1)
+    throw std::invalid_argument("Invalid listen address " + ms.address_);
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    throw std::system_error(errno, std::generic_category(),
+            "Unable to create listen socket");
+  }
+
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  if ((-1 == bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) ||
+      (-1 == listen(fd, 8))) {
+    int err = errno;
+    close(fd);
+    throw std::system_error(err, std::generic_category(),
+            "Unable to listen on port " + std::to_string(ms.port_));
+  }
+
+  return fd;
+}
+
+static std::string part_header(size_t length) {
+  return std::string("--") + BOUNDARY + "\r\n"
+         "Content-Type: image/jpeg\r\n"
+         "Content-Length: " + std::to_string(length) + "\r\n\r\n";
+}
+
+static void start_response(Client& c, std::string head, JpegPtr body,
+                           std::string tail) {
+  c.head_ = head;
+  c.body_ = body;
+  c.tail_ = tail;
+  c.sent_ = 0;
+}
+
+/* write as much of the current response as the socket takes, returns false
+ * if the connection failed */
+static bool send_some(int fd, Client& c) {
+  while (c.busy()) {
+    iovec iov[3];
+    int n = 0;
+    size_t skip = c.sent_;
+
+    const char* parts[3] = {c.head_.data(),
+                            c.body_ ? reinterpret_cast<const char*>(c.body_->data()) : nullptr,
+                            c.tail_.data()};
+    size_t lengths[3] = {c.head_.size(), c.body_ ? c.body_->size() : 0,
+                         c.tail_.size()};
+
+    for (int i = 0; i < 3; i++) {
+      if (skip >= lengths[i]) {
+        skip -= lengths[i];
+        continue;
+      }
+      iov[n].iov_base = const_cast<char*>(parts[i] + skip);
+      iov[n].iov_len = lengths[i] - skip;
+      skip = 0;
+      n++;
+    }
+
+    msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+
+    ssize_t r = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (r == -1) {
+      if (errno == EINTR) continue;
+      return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+    }
+    c.sent_ += r;
+  }
+
+  return true;
+}
+
+/* start the next frame for an idle client, true if there was one */
+static bool next_frame(Client& c) {
+  if (c.busy() || !c.pending_)
+    return false;
+
+  auto jpeg = c.pending_;
+  c.pending_ = nullptr;
+
+  if (c.streaming_) {
+    start_response(c, part_header(jpeg->size()), jpeg, "\r\n");
+  } else {
+    start_response(c, "HTTP/1.0 200 OK\r\n"
+                      "Content-Type: image/jpeg\r\n"
+                      "Content-Length: " + std::to_string(jpeg->size()) + "\r\n"
+                      "Cache-Control: no-cache\r\n"
+                      "Connection: close\r\n\r\n", jpeg, "");
+    c.close_after_send_ = true;
+  }
+  return true;
+}
+
+/* act on a complete request header */
+static void handle_request(Client& c) {
+  std::string line = c.request_.substr(0, c.request_.find("\r\n"));
+  std::string path;
+
+  if (line.compare(0, 4, "GET ") == 0) {
+    path = line.substr(4, line.find(' ', 4) - 4);
+  }
+
+  if ((path == "/stream") || (path == "/")) {
+    c.streaming_ = true;
+    start_response(c, std::string("HTTP/1.0 200 OK\r\n"
+                      "Content-Type: multipart/x-mixed-replace; boundary=") +
+                      BOUNDARY + "\r\n"
+                      "Cache-Control: no-cache\r\n"
+                      "Connection: close\r\n\r\n", nullptr, "");
+  } else if (path == "/snapshot.jpg") {
+    c.awaiting_frame_ = true;
+  } else {
+    start_response(c, "HTTP/1.0 404 Not Found\r\n"
+                      "Content-Length: 0\r\n"
+                      "Connection: close\r\n\r\n", nullptr, "");
+    c.close_after_send_ = true;
+  }
+}
+
+void mjpeg_server_thread(MjpegServerSetup ms, MjpegFeed& feed,
+                         Shutdown& shutdown) {
+  auto logger = spdlog::get("console");
+
+  int epfd = -1;
+  int listen_fd = -1;
+
+  try {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+      throw std::system_error(errno, std::generic_category(),
+              "Unable to create epoll instance");
+    }
+
+    listen_fd = listen_socket(ms);
+    epoll_set(epfd, EPOLL_CTL_ADD, shutdown.fd(), SHUTDOWN_TOKEN, EPOLLIN);
+    epoll_set(epfd, EPOLL_CTL_ADD, feed.fd(), FEED_TOKEN, EPOLLIN);
+    epoll_set(epfd, EPOLL_CTL_ADD, listen_fd, LISTEN_TOKEN, EPOLLIN);
+  } catch (const std::exception& e) {
+    logger->error("Could not start preview server: <{}>", e.what());
+    if (listen_fd != -1) { close(listen_fd); }
+    if (epfd != -1) { close(epfd); }
+    return;
+  }
+
+  logger->info("Serving preview on http://{}:{}/stream", ms.address_, ms.port_);
+
+  // keyed by fd, which is also the epoll token
+  std::map<int, Client> clients;
+
+  auto drop = [&](int fd) {
+    close(fd); // also removes it from the epoll set
+    clients.erase(fd);
+  };
+
+  // flush what we can, then wait for EPOLLOUT only while data is left over
+  auto flush = [&](int fd) {
+    Client& c = clients[fd];
+    do {
+      if (!send_some(fd, c)) {
+        drop(fd);
+        return;
+      }
+    } while (!c.busy() && !c.close_after_send_ && next_frame(c));
+
+    if (!c.busy() && c.close_after_send_) {
+      drop(fd);
+      return;
+    }
+
+    epoll_set(epfd, EPOLL_CTL_MOD, fd, fd,
+              c.busy() ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+  };
+
+  auto update_wanted = [&]() {
+    int n = 0;
+    for (auto& kv : clients) {
+      if (kv.second.streaming_ || kv.second.awaiting_frame_) n++;
+    }
+    feed.set_wanted(n);
+  };
+
+  while (!shutdown.requested()) {
+    epoll_event events[MAX_EVENTS];
+    int ret = epoll_wait(epfd, events, MAX_EVENTS, -1);
+
+    if (ret == -1) {
+      if (errno == EINTR)
+        continue;
+      logger->error("epoll_wait() call error with errno {}", errno);
+      break;
+    }
+
+    for (int e = 0; e < ret; e++) {
+      uint64_t token = events[e].data.u64;
+
+      if (token == SHUTDOWN_TOKEN) {
+        break;
+      }
+
+      if (token == LISTEN_TOKEN) {
+        int fd;
+        while ((fd = accept4(listen_fd, NULL, NULL,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+          clients[fd] = Client{"", false, false, false, "", nullptr, "", 0,
+                               nullptr};
+          try {
+            epoll_set(epfd, EPOLL_CTL_ADD, fd, fd, EPOLLIN);
+          } catch (const std::system_error& e) {
+            logger->warn("Could not add preview client: <{}>", e.what());
+            drop(fd);
+          }
+        }
+        continue;
+      }
+
+      if (token == FEED_TOKEN) {
+        feed.clear_notification();
+        auto jpeg = feed.latest();
+        if (!jpeg) continue;
+
+        std::vector<int> ready;
+        for (auto& kv : clients) {
+          Client& c = kv.second;
+          if (c.streaming_ || c.awaiting_frame_) {
+            c.pending_ = jpeg; // replaces any frame the client hasn't started
+            c.awaiting_frame_ = false;
+            ready.push_back(kv.first);
+          }
+        }
+
+        for (int fd : ready) {
+          if (!clients[fd].busy()) { flush(fd); }
+        }
+        update_wanted();
+        continue;
+      }
+
+      int fd = static_cast<int>(token);
+      if (clients.find(fd) == clients.end())
+        continue; // dropped earlier in this batch
+
+      Client& c = clients[fd];
+
+      if (events[e].events & (EPOLLERR | EPOLLHUP)) {
+        drop(fd);
+        update_wanted();
+        continue;
+      }
+
+      if (events[e].events & EPOLLIN) {
+        char buf[1024];
+        ssize_t n = read(fd, buf, sizeof(buf));
+
+        if ((n == 0) || ((n == -1) && (errno != EAGAIN))) {
+          drop(fd);
+          update_wanted();
+          continue;
+        }
+
+        // requests are only read up to the end of the header, anything a
+        // streaming client sends afterwards is ignored
+        bool complete = (c.request_.find("\r\n\r\n") != std::string::npos);
+        if ((n > 0) && !complete) {
+          c.request_.append(buf, n);
+
+          if (c.request_.find("\r\n\r\n") != std::string::npos) {
+            handle_request(c);
+            update_wanted();
+          } else if (c.request_.size() > MAX_REQUEST) {
+            drop(fd);
+            update_wanted();
+            continue;
+          }
+        }
+      }
+
+      flush(fd);
+    }
+  }
+
+  for (auto& kv : clients) {
+    close(kv.first);
+  }
+  feed.set_wanted(0);
+  close(listen_fd);
+  close(epfd);
+}
@@ -0,0 +1,27 @@
+#ifndef MJPEG_SERVER_H_
+#define MJPEG_SERVER_H_
+
+#include "mjpeg_feed.h"
+#include "shutdown.h"
+
+#include <string>
+
+struct MjpegServerSetup {
+  std::string address_; // listen address, e.g. 0.0.0.0
+  unsigned int port_;
+};
+
+/* Minimal HTTP server for live previews.
+ *
+ *   GET /stream        multipart/x-mixed-replace MJPEG stream
+ *   GET /snapshot.jpg  the next preview frame as a single JPEG
+ *
+ * Runs a single epoll loop over non-blocking sockets. Every client sends
+ * from the shared encoded frames; a client still busy with one frame when
+ * newer ones arrive only keeps the newest as pending, so slow clients skip
+ * frames instead of buffering them.
+ */
+void mjpeg_server_thread(MjpegServerSetup ms, MjpegFeed& feed,
+                         Shutdown& shutdown);
+
+#endif
@@ -1,65 +1,140 @@
 #include "poster_thread.h"
 #include "reader.h"
 
+#include "frame_image.h"
+#include "trace.h"
+#include "log_limit.h"
+
 #include <spdlog/spdlog.h>
-#include <jpeglib.h>
-#include <jerror.h>
-#define cimg_plugin "plugins/jpeg_buffer.h"
-#include <CImg.h>
-#include <cpr/cpr.h>
 #include <msgpack.hpp>
 
-using namespace cimg_library;
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <stdexcept>
 
-const unsigned char GREEN[] = {0, 255, 0};
+/* payload plus the frame it came from, for tracing */
+struct QueuedPayload {
+  PayloadPtr payload_;
+  uint64_t frame_id_;
+};
 
+struct SinkWorker {
+  SinkSetup setup_;
+  std::unique_ptr<ResultSink> sink_;
+  ThreadsafeQueue<QueuedPayload> queue_;
+  std::thread thread_;
+  int dropped_;
+  // per sink, so one backed up sink doesn't mute drops on the others
+  LogRateLimit drop_log_{std::chrono::milliseconds{5000}};
+};
 
-void poster_thread(std::string url_string,
-                   ThreadsafeQueue<ScanResult>& result_queue,
-                   std::atomic_bool& exit_flag) {
-  
+static PayloadPtr encode_payload(const ScanResult& r, MemoryBudget& budget) {
   auto logger = spdlog::get("console");
-  while(!exit_flag) {
-    auto r = result_queue.pop_with_timeout(1);
-    if ((r.frame_ == nullptr) || (url_string.empty())) { continue; }
-
-    // convert into image, draw result points, and encode as JPEG
-    CImg<unsigned char> frame(r.frame_->buf(), 3, r.frame_->cols(),
-                              r.frame_->rows());
-    frame.permute_axes("YZCX");
-    
-    for (auto& rp : r.result_points_) {
-      frame.draw_circle(rp.first, rp.second,
-                        10,
-                        GREEN);
-    }
-    
-    // should be smaller than raw bitmap
-    unsigned int jpeg_size = r.frame_->buflen();
-    JOCTET* jpeg_out = new JOCTET[jpeg_size];
-    frame.save_jpeg_buffer(jpeg_out, jpeg_size, 60);
-    
-    msgpack::sbuffer sbuf;
-    // put in the JPEG
-    msgpack::pack(sbuf, msgpack::type::raw_ref(reinterpret_cast<char*>(jpeg_out),
-                  jpeg_size));
-    
-    // barcode text, format, and result_points_ array
+  TRACE_SPAN("payload", r.frame_id_);
+  msgpack::sbuffer sbuf;
+  JpegPtr jpeg = r.jpeg_;
+  unsigned int jpeg_size = 0;
+
+  if (jpeg) {
+    // already encoded (previews, thumbnails)
+    jpeg_size = jpeg->size();
+    msgpack::pack(sbuf, msgpack::type::raw_ref(
+          reinterpret_cast<const char*>(jpeg->data()), jpeg_size));
+  } else if (r.frame_->format() == FrameFormat::JPEG) {
+    // forward the camera's JPEG as is, consumers draw the result points
+    jpeg_size = r.frame_->buflen();
+    msgpack::pack(sbuf, msgpack::type::raw_ref(
+          reinterpret_cast<const char*>(r.frame_->buf()), jpeg_size));
+  } else {
+    // draw result points into the RGB or grey frame and encode as JPEG
+    TRACE_SPAN("jpeg", r.frame_id_);
+    jpeg = encode_jpeg(render_frame(*r.frame_, r.result_points_, 0), 60);
+    jpeg_size = jpeg->size();
+    msgpack::pack(sbuf, msgpack::type::raw_ref(
+          reinterpret_cast<const char*>(jpeg->data()), jpeg_size));
+  }
+  
+  // barcode text, format, and result_points_ array
+  {
+    TRACE_SPAN("msgpack", r.frame_id_);
     msgpack::pack(sbuf, r.text_);
     msgpack::pack(sbuf, r.format_);
     msgpack::pack(sbuf, r.result_points_);
-     logger->debug("jpeg {} bytes, msgpack {} bytes", jpeg_size, sbuf.size());
+  }
+  logger->debug("jpeg {} bytes, msgpack {} bytes", jpeg_size, sbuf.size());
 
-    auto post = cpr::Post(cpr::Url(url_string),
-          cpr::Body{sbuf.data(), sbuf.size()},
-          cpr::Timeout{1000});
+  // charged until the last sink queue lets go of it
+  size_t bytes = sbuf.size();
+  budget.charge(bytes);
+  return PayloadPtr(new Payload(sbuf.data(), sbuf.size()),
+                    [&budget, bytes](const Payload* p) {
+                      budget.release(bytes);
+                      delete p;
+                    });
+}
 
-    if (!post.error.message.empty()) {
-      logger->warn("Could not post result: {}", post.error.message);
-    }
-    delete[] jpeg_out;
-    
+static void sink_thread(ResultSink& sink,
+                        ThreadsafeQueue<QueuedPayload>& queue) {
+  TRACE_THREAD(sink.name());
+  while (true) {
+    auto p = queue.wait_and_pop();
+    if (p.payload_ == nullptr) { break; } // queue closed on shutdown
 
+    TRACE_SPAN("publish", p.frame_id_);
+    sink.publish(*p.payload_);
   }
 }
 
+void poster_thread(std::vector<SinkSetup> sinks,
+                   ThreadsafeQueue<ScanResult>& result_queue,
+                   MemoryBudget& budget,
+                   Shutdown& shutdown) {
+  
+  auto logger = spdlog::get("console");
+  TRACE_THREAD("poster");
+  std::vector<std::unique_ptr<SinkWorker>> workers;
+
+  for (auto& s : sinks) {
+    std::unique_ptr<SinkWorker> w(new SinkWorker());
+    w->setup_ = s;
+    w->dropped_ = 0;
+
+    try {
+      w->sink_ = make_result_sink(s);
+    } catch (const std::exception& e) {
+      logger->error("Could not create sink {}: <{}>", s.uri_, e.what());
+      continue;
+    }
+
+    logger->info("Publishing results to {} (queue {}, drop {})",
+                 w->sink_->name(), s.queue_size_,
+                 s.drop_policy_ == DropPolicy::DROP_OLDEST ? "oldest" : "newest");
+    w->thread_ = std::thread(sink_thread, std::ref(*w->sink_),
+                             std::ref(w->queue_));
+    workers.push_back(std::move(w));
+  }
+
+  while(!shutdown.requested()) {
+    auto r = result_queue.wait_and_pop();
+    if (!r.frame_ && !r.jpeg_) { break; } // queue closed on shutdown
+    if (workers.empty()) { continue; }
+
+    QueuedPayload payload {encode_payload(r, budget), r.frame_id_};
+
+    for (auto& w : workers) {
+      bool drop_oldest = (w->setup_.drop_policy_ == DropPolicy::DROP_OLDEST);
+      if (!w->queue_.push_bounded(payload, w->setup_.queue_size_, drop_oldest)) {
+        w->dropped_++;
+        LOG_LIMITED_BY(w->drop_log_, logger, warn,
+                       "{} queue full, dropped result ({} total)",
+                       w->sink_->name(), w->dropped_);
+      }
+    }
+  }
+
+  for (auto& w : workers) {
+    w->queue_.close();
+    w->thread_.join();
+  }
+}
@@ -1,17 +1,26 @@
 #ifndef POSTER_THREAD_H_
 #define POSTER_THREAD_H_
 
-#include <atomic>
 #include <string>
+#include <vector>
 
 #include "threadsafe_queue.h"
-
-static const int TIMEOUT_SECONDS = 1;
+#include "shutdown.h"
+#include "result_sink.h"
+#include "memory_budget.h"
 
 struct ScanResult;
 
-void poster_thread(std::string url_string,
+/* Encode results from result_queue once and fan them out to the sinks.
+ *
+ * Every sink gets its own thread and bounded queue with the configured drop
+ * policy, so a slow or unreachable sink doesn't hold up the others.
+ * Queued payloads are charged against budget, the bounded sink queues
+ * and the decoder's thumbnail fallback keep them from piling up.
+ */
+void poster_thread(std::vector<SinkSetup> sinks,
                    ThreadsafeQueue<ScanResult>& result_queue,
-                   std::atomic_bool& exit_flag);
+                   MemoryBudget& budget,
+                   Shutdown& shutdown);
 
 #endif
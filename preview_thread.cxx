@@ -0,0 +1,87 @@
+#include "preview_thread.h"
+
+#include "frame_image.h"
+#include "trace.h"
+
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <memory>
+#include <algorithm>
+
+using namespace cimg_library;
+
+void preview_thread(PreviewSetup ps,
+                    LatestSlot<ScanResult>& preview_slot,
+                    ThreadsafeQueue<ScanResult>& result_queue,
+                    MjpegFeed& feed,
+                    Shutdown& shutdown) {
+
+  auto logger = spdlog::get("console");
+  TRACE_THREAD("preview");
+  auto frame_interval = std::chrono::microseconds{1000000 / std::max(1u, ps.fps_)};
+  auto post_interval = std::chrono::milliseconds{ps.post_interval_ms_};
+
+#ifdef XDISPLAY
+  std::unique_ptr<CImgDisplay> disp;
+#else
+  if (ps.display_) {
+    logger->warn("Not compiled with X11 support - cannot show preview");
+  }
+#endif
+
+  auto last_post_time = std::chrono::steady_clock::now();
+
+  while (!shutdown.requested()) {
+    auto start = std::chrono::steady_clock::now();
+    auto r = preview_slot.wait_and_take();
+    if (r.frame_ == nullptr) { break; } // slot closed on shutdown
+
+    auto now_time = std::chrono::steady_clock::now();
+    bool post = (ps.post_interval_ms_ > 0) &&
+                (now_time - last_post_time >= post_interval) &&
+                (result_queue.size() == 0);
+    bool stream = feed.wanted();
+    bool show = false;
+#ifdef XDISPLAY
+    show = ps.display_;
+#endif
+
+    if (post || stream || show) {
+      TRACE_SCOPE(render_span, "render");
+      TRACE_FRAME(render_span, r.frame_id_);
+      auto img = render_frame(*r.frame_, r.result_points_, ps.width_);
+      TRACE_STOP(render_span);
+
+#ifdef XDISPLAY
+      if (show) {
+        if (!disp) {
+          disp.reset(new CImgDisplay(img.width(), img.height(),
+                                     "barcode preview", 0, false, false));
+        }
+        img.display(*disp);
+      }
+#endif
+
+      JpegPtr jpeg;
+      if (post || stream) {
+        TRACE_SPAN("encode", r.frame_id_);
+        jpeg = encode_jpeg(img, ps.quality_);
+      }
+
+      if (stream) {
+        feed.publish(jpeg);
+      }
+
+      if (post) {
+        ScanResult preview;
+        preview.jpeg_ = jpeg;
+        result_queue.push(preview);
+        last_post_time = now_time;
+      }
+    }
+
+    // rate limit, frames arriving meanwhile replace each other in the slot
+    preview_slot.wait_until(start + frame_interval);
+  }
+}
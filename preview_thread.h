@@ -0,0 +1,34 @@
+#ifndef PREVIEW_THREAD_H_
+#define PREVIEW_THREAD_H_
+
+#include "reader.h"
+#include "latest_slot.h"
+#include "threadsafe_queue.h"
+#include "shutdown.h"
+#include "mjpeg_feed.h"
+
+struct PreviewSetup {
+  bool display_;          // show an X11 window (-p)
+  unsigned int fps_;      // max preview frames rendered per second
+  unsigned int width_;    // preview width, height keeps the aspect ratio
+  unsigned int quality_;  // JPEG quality of published previews
+  unsigned int post_interval_ms_; // publish a preview this often, 0 = never
+};
+
+/* Render and publish previews of the decoded frames.
+ *
+ * The decode thread puts every frame with its scan result into the slot,
+ * which only ever holds the latest one. This thread takes at most fps_
+ * frames a second from it, downscales them with the result points drawn
+ * in, shows them, feeds them to the MJPEG server while it has clients and
+ * periodically pushes an encoded preview into the result queue (only while
+ * the queue is empty, so previews never delay scan results). Each frame is
+ * encoded at most once. Decode throughput doesn't depend on any of this.
+ */
+void preview_thread(PreviewSetup ps,
+                    LatestSlot<ScanResult>& preview_slot,
+                    ThreadsafeQueue<ScanResult>& result_queue,
+                    MjpegFeed& feed,
+                    Shutdown& shutdown);
+
+#endif
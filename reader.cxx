@@ -1,58 +1,444 @@
 #include "reader.h"
+#include "frame_luminance_source.h"
+#include "trace.h"
 
 #include "TextUtfEncoding.h"
-#include "GenericLuminanceSource.h"
+#include "GlobalHistogramBinarizer.h"
 #include "HybridBinarizer.h"
 #include "BinaryBitmap.h"
 #include "MultiFormatReader.h"
 #include "Result.h"
 #include "DecodeHints.h"
+#include "GenericLuminanceSource.h"
+
+#include <algorithm>
+#include <sstream>
 
 using namespace ZXing;
 
+// below this (5th to 95th percentile luma spread) ADAPTIVE goes straight to
+// the hybrid binarizer, a global threshold rarely separates bars from paper
+static const int LOW_CONTRAST = 48;
+static const unsigned int CONTRAST_SAMPLE_STEP = 4; // every 4th row and column
+
+// a scanline that didn't read counts as a near miss (and escalates to a
+// full decode) with this many light/dark transitions of at least this
+// contrast, the shortest supported codes (EAN-8) have over 40
+static const int NEAR_MISS_CONTRAST = 32;
+static const unsigned int NEAR_MISS_TRANSITIONS = 20;
+
+// weight of the latest frame in the per format hit rate
+static const float HIT_RATE_ALPHA = 0.05f;
+
+bool BinarizerModeFromString(const std::string& s, BinarizerMode& mode) {
+  if (s == "global") {
+    mode = BinarizerMode::GLOBAL;
+  } else if (s == "hybrid") {
+    mode = BinarizerMode::HYBRID;
+  } else if (s == "adaptive") {
+    mode = BinarizerMode::ADAPTIVE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ScanlineSetupFromString(const std::string& s, ScanlineSetup& setup) {
+  std::istringstream in(s);
+  std::string rows, band;
+  std::getline(in, rows, '/');
+  std::getline(in, band, '/');
+
+  try {
+    setup.rows_ = std::stoul(rows);
+    setup.band_ = band.empty() ? 1 : std::stoul(band);
+  } catch (const std::logic_error&) {
+    return false;
+  }
+
+  return (setup.rows_ > 0) && (setup.rows_ <= MAX_SCANLINES) &&
+         (setup.band_ > 0);
+}
+
+bool IsMatrixFormat(BarcodeFormat f) {
+  return (f == BarcodeFormat::AZTEC) || (f == BarcodeFormat::DATA_MATRIX) ||
+         (f == BarcodeFormat::MAXICODE) || (f == BarcodeFormat::PDF_417) ||
+         (f == BarcodeFormat::QR_CODE);
+}
+
 BarcodeReader::BarcodeReader(std::vector<BarcodeFormat> fmts, 
-                             bool tryHarder, bool tryRotate) {
+                             bool tryHarder, bool tryRotate,
+                             BinarizerMode mode,
+                             ScanlineSetup scanlines,
+                             FormatOrderSetup order):
+  order_(order),
+  frames_(0),
+  retry_demoted_(false),
+  mode_(mode),
+  scanlines_(scanlines),
+  has_2d_(false) {
   DecodeHints hints;
   hints.setShouldTryHarder(tryHarder);
   hints.setShouldTryRotate(tryRotate);
-  hints.setPossibleFormats(fmts);
 
-  reader_ = std::make_shared<MultiFormatReader>(hints);
+  // adaptive ordering needs one reader per format so each can be timed,
+  // ordered and demoted, otherwise a single reader tries them all at once
+  for (auto f : fmts) {
+    FormatReader fr;
+    if (order_.adaptive_) {
+      hints.setPossibleFormats({f});
+      fr.reader_ = std::make_shared<MultiFormatReader>(hints);
+    }
+    fr.stats_ = FormatStats{f, 0, 0, std::chrono::microseconds{0}, 0, 0.0f,
+                            false, FrameClock::now()};
+    readers_.push_back(fr);
+  }
+
+  if (!order_.adaptive_) {
+    hints.setPossibleFormats(fmts);
+    reader_ = std::make_shared<MultiFormatReader>(hints);
+  }
+
+  std::vector<BarcodeFormat> linear;
+  for (auto f : fmts) {
+    if (IsMatrixFormat(f)) {
+      has_2d_ = true;
+    } else {
+      linear.push_back(f);
+    }
+  }
+
+  // the lines are already horizontal, no rotation. Without try harder the
+  // 1D readers only look at 15 rows around the middle, with it at every
+  // row of an image up to 255 high, so each line is read exactly once
+  if ((scanlines_.rows_ > 0) && !linear.empty()) {
+    DecodeHints line_hints;
+    line_hints.setShouldTryHarder(true);
+    line_hints.setShouldTryRotate(false);
+    line_hints.setPossibleFormats(linear);
+    line_reader_ = std::make_shared<MultiFormatReader>(line_hints);
+  }
+
+  reset_stats();
 }
 
-static std::shared_ptr<LuminanceSource> CreateLuminanceSource(FramePtr frame) {
-  return std::make_shared<GenericLuminanceSource>(frame->cols(),
-                frame->rows(),
-                frame->buf(),
-                frame->cols()*3,
-                3, 2, 1, 0);
+void BarcodeReader::reset_stats() {
+  global_stats_ = BinarizerStats{0, 0, std::chrono::microseconds{0}};
+  hybrid_stats_ = BinarizerStats{0, 0, std::chrono::microseconds{0}};
+  scanline_stats_ = BinarizerStats{0, 0, std::chrono::microseconds{0}};
+  escalations_ = 0;
+
+  for (auto& fr : readers_) {
+    fr.stats_.attempts_ = fr.stats_.hits_ = fr.stats_.timed_ = 0;
+    fr.stats_.time_ = std::chrono::microseconds{0};
+  }
 }
 
-static std::shared_ptr<BinaryBitmap> CreateBinaryBitmap(FramePtr frame) {
-  return std::make_shared<HybridBinarizer>(CreateLuminanceSource(frame));
+std::vector<FormatStats> BarcodeReader::format_stats() const {
+  std::vector<FormatStats> v;
+  for (auto& fr : readers_) {
+    v.push_back(fr.stats_);
+  }
+  return v;
 }
 
-ScanResult BarcodeReader::scan(FramePtr f) {
+Result BarcodeReader::read_formats(const BinaryBitmap& bin) {
   Result result(DecodeStatus::NotFound);
-  
-  auto bin = CreateBinaryBitmap(f);
+  const auto now = FrameClock::now();
+
+  if (reader_ != nullptr) {
+    // combined reader, every format was tried but only the read is timed
+    result = reader_->read(bin);
+    for (auto& fr : readers_) {
+      auto& st = fr.stats_;
+      st.attempts_++;
+      if (result.isValid() && (st.format_ == result.format())) {
+        st.hits_++;
+        st.last_hit_ = now;
+      }
+    }
+  } else {
+    for (auto& fr : readers_) {
+      auto& st = fr.stats_;
+      if (st.demoted_ && !retry_demoted_) continue;
+
+      auto start = std::chrono::steady_clock::now();
+      Result r = fr.reader_->read(bin);
+      st.attempts_++;
+      st.timed_++;
+      st.time_ += std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start);
+
+      if (r.isValid()) {
+        st.hits_++;
+        st.last_hit_ = now;
+        st.demoted_ = false;
+        result = r;
+        break;
+      }
+    }
+  }
+
+  update_format_order(result);
+  return result;
+}
+
+void BarcodeReader::update_format_order(const Result& result) {
+  // formats that weren't tried didn't read this frame either
+  auto latest_hit = FrameClock::time_point::min();
+  for (auto& fr : readers_) {
+    auto& st = fr.stats_;
+    bool hit = result.isValid() && (st.format_ == result.format());
+    st.hit_rate_ += HIT_RATE_ALPHA * ((hit ? 1.0f : 0.0f) - st.hit_rate_);
+    latest_hit = std::max(latest_hit, st.last_hit_);
+  }
+
+  if (!order_.adaptive_) return;
+
+  if (result.isValid()) {
+    std::stable_sort(readers_.begin(), readers_.end(),
+        [](const FormatReader& a, const FormatReader& b) {
+          return a.stats_.hit_rate_ > b.stats_.hit_rate_;
+        });
+  }
+
+  // demote only while something else reads, an empty scene demotes nothing
+  if (order_.demote_after_.count() > 0) {
+    for (auto& fr : readers_) {
+      auto& st = fr.stats_;
+      if (!st.demoted_ && (latest_hit - st.last_hit_ > order_.demote_after_)) {
+        st.demoted_ = true;
+      }
+    }
+  }
+}
+
+static std::shared_ptr<LuminanceSource> CreateLuminanceSource(FramePtr frame) {
+  // luma plane is shared with the thumbnail hash, computed in one pass,
+  // the source reads it in place
+  if (!frame->compute_luma())
+    return nullptr;
+  return std::make_shared<FrameLuminanceSource>(frame);
+}
+
+/* spread between the 5th and 95th percentile of a sparse luma sample */
+static int EstimateContrast(const Frame& f) {
+  unsigned int hist[256] = {};
+  unsigned int n = 0;
+  const unsigned char* luma = f.luma();
+
+  for (unsigned int y = 0; y < f.luma_rows(); y += CONTRAST_SAMPLE_STEP) {
+    const unsigned char* row = luma + static_cast<size_t>(y) * f.luma_cols();
+    for (unsigned int x = 0; x < f.luma_cols(); x += CONTRAST_SAMPLE_STEP) {
+      hist[row[x]]++;
+      n++;
+    }
+  }
 
-  result = reader_->read(*bin);
+  unsigned int lo_count = n / 20, hi_count = n - n / 20;
+  int lo = 0, hi = 255;
+  unsigned int acc = 0;
+  for (int v = 0; v < 256; v++) {
+    acc += hist[v];
+    if (acc <= lo_count) lo = v;
+    if (acc < hi_count) hi = v + 1;
+  }
+
+  return hi - lo;
+}
+
+ScanResult BarcodeReader::read(FramePtr f, const BinaryBitmap& bin,
+                               BinarizerStats& stats,
+                               std::chrono::steady_clock::time_point start) {
+  Result result = read_formats(bin);
+
+  stats.attempts_++;
+  stats.time_ += std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
   
   if (result.isValid()) {
+    stats.hits_++;
+
     std::string text;
     TextUtfEncoding::ToUtf8(result.text(), text);
+    // back from luma plane to frame coordinates
+    const int scale = f->luma_scale();
     std::vector<std::pair<int,int>> v;
     for (auto& rp : result.resultPoints()) {
-      v.push_back({static_cast<int>(rp.x()), static_cast<int>(rp.y())});
+      v.push_back({static_cast<int>(rp.x()) * scale,
+                   static_cast<int>(rp.y()) * scale});
     }
     return ScanResult{f,
                       ToString(result.format()),
                       text,
-                      v};
+                      v,
+                      nullptr,
+                      f->id(),
+                      f->sharpness()};
+  }
+
+  auto sr = ScanResult();
+  sr.frame_ = f;
+  sr.frame_id_ = f->id();
+  sr.sharpness_ = f->sharpness();
+  return sr;
+}
+
+/* enough high contrast light/dark transitions to be bars, with hysteresis
+ * so sensor noise around the threshold doesn't count */
+static bool LooksLikeBars(const uint8_t* row, unsigned int width) {
+  auto mm = std::minmax_element(row, row + width);
+  int lo = *mm.first, hi = *mm.second;
+  if (hi - lo < NEAR_MISS_CONTRAST)
+    return false;
+
+  const int mid = (lo + hi) / 2, hyst = (hi - lo) / 8;
+  bool light = row[0] > mid;
+  unsigned int transitions = 0;
+
+  for (unsigned int x = 1; x < width; x++) {
+    if (light && (row[x] < mid - hyst)) {
+      light = false;
+      transitions++;
+    } else if (!light && (row[x] > mid + hyst)) {
+      light = true;
+      transitions++;
+    }
+  }
+
+  return transitions >= NEAR_MISS_TRANSITIONS;
+}
+
+ScanResult BarcodeReader::scan_lines(FramePtr f, bool& near_miss) {
+  TRACE_SPAN("scanlines", f->id());
+  auto start = std::chrono::steady_clock::now();
+
+  const unsigned int w = f->luma_cols(), h = f->luma_rows();
+  const unsigned int n = std::min(scanlines_.rows_, h);
+  const unsigned int band = std::max(1u, std::min(scanlines_.band_, h / n));
+  const uint8_t* luma = f->luma();
+
+  lines_.resize(static_cast<size_t>(n) * w);
+  band_sum_.resize(w);
+  line_y_.resize(n);
+  near_miss = false;
+
+  for (unsigned int i = 0; i < n; i++) {
+    unsigned int centre = (2 * i + 1) * h / (2 * n);
+    unsigned int top = std::min(centre - std::min(centre, band / 2), h - band);
+    line_y_[i] = centre;
+
+    std::fill(band_sum_.begin(), band_sum_.end(), 0);
+    for (unsigned int y = top; y < top + band; y++) {
+      const uint8_t* row = luma + static_cast<size_t>(y) * w;
+      for (unsigned int x = 0; x < w; x++) {
+        band_sum_[x] += row[x];
+      }
+    }
+
+    uint8_t* line = &lines_[static_cast<size_t>(i) * w];
+    for (unsigned int x = 0; x < w; x++) {
+      line[x] = static_cast<uint8_t>(band_sum_[x] / band);
+    }
+
+    near_miss = near_miss || LooksLikeBars(line, w);
   }
 
+  // 1D readers binarize one row at a time with its own histogram
+  auto lum = std::make_shared<GenericLuminanceSource>(0, 0, w, n,
+                                                      lines_.data(), w);
+  GlobalHistogramBinarizer bin(lum);
+  Result result = line_reader_->read(bin);
+
+  scanline_stats_.attempts_++;
+  scanline_stats_.time_ += std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+
   auto sr = ScanResult();
   sr.frame_ = f;
+  sr.frame_id_ = f->id();
+  sr.sharpness_ = f->sharpness();
+
+  // the line reader tries every 1D format at once, untimed like the
+  // combined reader; its reads count towards the format order too
+  const auto now = FrameClock::now();
+  for (auto& fr : readers_) {
+    auto& st = fr.stats_;
+    if (IsMatrixFormat(st.format_)) continue;
+
+    st.attempts_++;
+    if (result.isValid() && (st.format_ == result.format())) {
+      st.hits_++;
+      st.last_hit_ = now;
+      st.demoted_ = false;
+    }
+  }
+
+  if (result.isValid()) {
+    // a miss is settled by the full decode, if it escalates
+    update_format_order(result);
+
+    scanline_stats_.hits_++;
+    TextUtfEncoding::ToUtf8(result.text(), sr.text_);
+    sr.format_ = ToString(result.format());
+
+    // rows of the stacked image back to luma rows, then frame coordinates
+    const int scale = f->luma_scale();
+    for (auto& rp : result.resultPoints()) {
+      int line = std::min<int>(std::max(0, static_cast<int>(rp.y())), n - 1);
+      sr.result_points_.push_back({static_cast<int>(rp.x()) * scale,
+                                   static_cast<int>(line_y_[line]) * scale});
+    }
+  }
+
   return sr;
 }
+
+ScanResult BarcodeReader::scan(FramePtr f) {
+  auto lum = CreateLuminanceSource(f);
+  if (lum == nullptr) {
+    auto sr = ScanResult();
+    sr.frame_ = f;
+    sr.frame_id_ = f->id();
+    sr.sharpness_ = f->sharpness();
+    return sr;
+  }
+
+  retry_demoted_ = (order_.retry_every_ > 0) &&
+                   ((frames_++ % order_.retry_every_) == 0);
+
+  if (line_reader_ != nullptr) {
+    bool near_miss = false;
+    auto res = scan_lines(f, near_miss);
+    if (!res.text_.empty())
+      return res;
+
+    // nothing bar-like on the lines, skip the full decode unless 2D codes
+    // could still be there
+    if (!near_miss && !has_2d_)
+      return res;
+
+    if (near_miss)
+      escalations_++;
+  }
+  bool try_global = (mode_ == BinarizerMode::GLOBAL);
+
+  if (mode_ == BinarizerMode::ADAPTIVE)
+    try_global = (EstimateContrast(*f) >= LOW_CONTRAST);
+
+  if (try_global) {
+    // ZXing binarizes lazily, inside the read
+    TRACE_SPAN("binarize+decode global", f->id());
+    auto start = std::chrono::steady_clock::now();
+    GlobalHistogramBinarizer bin(lum);
+    auto res = read(f, bin, global_stats_, start);
+
+    if (!res.text_.empty() || (mode_ == BinarizerMode::GLOBAL))
+      return res;
+  }
+
+  TRACE_SPAN("binarize+decode hybrid", f->id());
+  auto start = std::chrono::steady_clock::now();
+  HybridBinarizer bin(lum);
+  return read(f, bin, hybrid_stats_, start);
+}
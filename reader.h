@@ -8,27 +8,135 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <chrono>
 #include <utility>
+#include <cstdint>
 
 namespace ZXing {
   class MultiFormatReader;
+  class BinaryBitmap;
+  class Result;
 }
 
+/* an already encoded JPEG, posted instead of encoding frame_ */
+using JpegPtr = std::shared_ptr<const std::vector<unsigned char>>;
+
 struct ScanResult {
   FramePtr frame_;
   std::string format_;
   std::string text_;
   std::vector<std::pair<int,int>> result_points_;
+  JpegPtr jpeg_;
+  uint64_t frame_id_ = 0; // outlives frame_ in compacted results
+  uint32_t sharpness_ = 0; // focus score of the frame, see sharpness.h
+};
+
+enum class BinarizerMode {
+  GLOBAL,  // one histogram threshold per row, cheap, fine for well lit 1D
+  HYBRID,  // local block thresholds, robust to uneven lighting
+  ADAPTIVE // GLOBAL first, HYBRID on a miss or a low contrast frame
+};
+
+// returns false for unknown names ("global", "hybrid", "adaptive")
+bool BinarizerModeFromString(const std::string& s, BinarizerMode& mode);
+
+// 2D formats, these carry their own error correction
+bool IsMatrixFormat(ZXing::BarcodeFormat f);
+
+struct BinarizerStats {
+  unsigned long attempts_;
+  unsigned long hits_;
+  std::chrono::microseconds time_; // binarize + read
+};
+
+/* Scanline mode for 1D codes that always pass horizontally: rows_ evenly
+ * spaced lines, each the average of band_ adjacent luma rows, are stacked
+ * into a small image that only the 1D readers see, one histogram threshold
+ * per line. The full frame is only decoded when a line looked like bars
+ * but didn't read (or 2D formats are enabled). */
+struct ScanlineSetup {
+  unsigned int rows_; // 0 = off, at most MAX_SCANLINES
+  unsigned int band_; // 1 = single rows
+};
+
+// ZXing's 1D readers visit every row of an image up to this height
+const unsigned int MAX_SCANLINES = 255;
+
+// "N[/band]", returns false if malformed or N is out of range
+bool ScanlineSetupFromString(const std::string& s, ScanlineSetup& setup);
+
+/* Without adaptive_ all formats share one combined reader, as cheap as it
+ * gets; hits are counted per format but decode time isn't. With adaptive_
+ * every format has its own reader, timed and tried in order of the recent
+ * hit rate, and formats that haven't read for demote_after_ while others
+ * have are only tried on every retry_every_-th frame until they read
+ * again. */
+struct FormatOrderSetup {
+  bool adaptive_;
+  std::chrono::seconds demote_after_; // 0 = never demote
+  unsigned int retry_every_;
+};
+
+struct FormatStats {
+  ZXing::BarcodeFormat format_;
+  unsigned long attempts_; // full decodes and scanline reads
+  unsigned long hits_;
+  std::chrono::microseconds time_;
+  unsigned long timed_; // attempts in time_, only per-format readers time
+  float hit_rate_; // moving average of reads per read attempt
+  bool demoted_;
+  FrameClock::time_point last_hit_;
 };
 
 class BarcodeReader {
   public:
     explicit BarcodeReader(std::vector<ZXing::BarcodeFormat> fmts,
-          bool try_harder = true, bool try_rotate = true); 
+          bool try_harder = true, bool try_rotate = true,
+          BinarizerMode mode = BinarizerMode::HYBRID,
+          ScanlineSetup scanlines = ScanlineSetup{0, 1},
+          FormatOrderSetup order = FormatOrderSetup{false,
+                                     std::chrono::seconds{0}, 1}); 
 
     ScanResult scan(FramePtr frame);
+
+    const BinarizerStats& global_stats() const { return global_stats_; }
+    const BinarizerStats& hybrid_stats() const { return hybrid_stats_; }
+    const BinarizerStats& scanline_stats() const { return scanline_stats_; }
+    // scanline misses that went on to a full decode
+    unsigned long escalations() const { return escalations_; }
+    // in the order they are currently tried
+    std::vector<FormatStats> format_stats() const;
+    void reset_stats();
   private:
-    std::shared_ptr<ZXing::MultiFormatReader> reader_;
+    ScanResult read(FramePtr f, const ZXing::BinaryBitmap& bin,
+                    BinarizerStats& stats,
+                    std::chrono::steady_clock::time_point start);
+
+    struct FormatReader {
+      std::shared_ptr<ZXing::MultiFormatReader> reader_;
+      FormatStats stats_;
+    };
+
+    ScanResult scan_lines(FramePtr f, bool& near_miss);
+    ZXing::Result read_formats(const ZXing::BinaryBitmap& bin);
+    void update_format_order(const ZXing::Result& result);
+
+    std::vector<FormatReader> readers_; // reader_ set only if adaptive
+    std::shared_ptr<ZXing::MultiFormatReader> reader_; // all formats, null if adaptive
+    FormatOrderSetup order_;
+    unsigned long frames_; // for retrying demoted formats
+    bool retry_demoted_;   // in this frame's reads
+    std::shared_ptr<ZXing::MultiFormatReader> line_reader_; // 1D only
+    BinarizerMode mode_;
+    ScanlineSetup scanlines_;
+    bool has_2d_; // formats the scanlines can't read
+    BinarizerStats global_stats_;
+    BinarizerStats hybrid_stats_;
+    BinarizerStats scanline_stats_;
+    unsigned long escalations_;
+    std::vector<uint8_t> lines_;       // stacked scanlines, reused
+    std::vector<uint32_t> band_sum_;
+    std::vector<unsigned int> line_y_; // luma row at the centre of each line
 };
 
 #endif
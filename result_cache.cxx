@@ -0,0 +1,49 @@
+#include "result_cache.h"
+
+static const size_t MAX_ENTRIES = 8;
+
+static unsigned int hamming(uint64_t a, uint64_t b) {
+  return static_cast<unsigned int>(__builtin_popcountll(a ^ b));
+}
+
+ResultCache::ResultCache(ResultCacheSetup setup):
+  setup_(setup),
+  hits_{0},
+  lookups_{0} {
+}
+
+bool ResultCache::lookup(const Frame& f, ScanResult& out) {
+  if (!setup_.enabled_) return false;
+
+  lookups_++;
+
+  // expire from the back, entries are ordered newest first
+  auto now = f.timestamp();
+  while (!entries_.empty() && (now - entries_.back().time_ > setup_.max_age_)) {
+    entries_.pop_back();
+  }
+
+  for (auto& e : entries_) {
+    if (e.device_ == f.device() &&
+        hamming(e.hash_, f.thumb_hash()) <= setup_.max_distance_) {
+      out.format_ = e.result_.format_;
+      out.text_ = e.result_.text_;
+      out.result_points_ = e.result_.result_points_;
+      hits_++;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ResultCache::store(const Frame& f, const ScanResult& r) {
+  if (!setup_.enabled_ || r.text_.empty()) return;
+
+  Entry e {f.device(), f.thumb_hash(), f.timestamp(), r};
+  e.result_.frame_ = nullptr;
+  entries_.push_front(e);
+
+  if (entries_.size() > MAX_ENTRIES)
+    entries_.pop_back();
+}
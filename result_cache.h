@@ -0,0 +1,52 @@
+#ifndef RESULT_CACHE_H_
+#define RESULT_CACHE_H_
+
+#include "frame.h"
+#include "reader.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+struct ResultCacheSetup {
+  bool enabled_;
+  unsigned int max_distance_;       // max differing hash bits for a hit
+  std::chrono::milliseconds max_age_; // entries older than this are ignored
+};
+
+/* Remembers recent successful decodes by the frame's thumbnail hash so a
+ * scene that hasn't changed (a label sitting under the camera) can reuse
+ * the previous decode instead of binarizing and reading it again.
+ *
+ * Only successful decodes are cached, a new label entering an otherwise
+ * static scene changes the hash and misses. Entries only match frames from
+ * the device they were stored for, two cameras looking at similar scenes
+ * must not answer for each other.
+ */
+class ResultCache {
+  public:
+    explicit ResultCache(ResultCacheSetup setup);
+
+    // fills format, text and result points of out on a hit
+    bool lookup(const Frame& f, ScanResult& out);
+    void store(const Frame& f, const ScanResult& r);
+
+    bool enabled() const { return setup_.enabled_; }
+    unsigned long hits() const { return hits_; }
+    unsigned long lookups() const { return lookups_; }
+    void reset_stats() { hits_ = lookups_ = 0; }
+  private:
+    struct Entry {
+      unsigned int device_; // hashes only compare within one camera
+      uint64_t hash_;
+      FrameClock::time_point time_;
+      ScanResult result_; // without frame_, so the cache holds no frames
+    };
+
+    ResultCacheSetup setup_;
+    std::deque<Entry> entries_;
+    unsigned long hits_;
+    unsigned long lookups_;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include "result_sink.h"
+#include "http_sink.h"
+#include "stream_sink.h"
+#include "shm_sink.h"
+
+#include <sstream>
+#include <stdexcept>
+
+static const size_t DEFAULT_QUEUE_SIZE = 5;
+
+static unsigned long option_ulong(const SinkSetup& s, const std::string& key,
+                                  unsigned long def) {
+  auto it = s.options_.find(key);
+  if (it == s.options_.end())
+    return def;
+
+  try {
+    return std::stoul(it->second);
+  } catch (const std::logic_error&) {
+    throw std::invalid_argument("Invalid value for sink option " + key);
+  }
+}
+
+SinkSetup parse_sink_setup(const std::string& arg) {
+  SinkSetup s {"", DEFAULT_QUEUE_SIZE, DropPolicy::DROP_NEWEST, {}};
+
+  std::istringstream in(arg);
+  std::getline(in, s.uri_, ',');
+
+  std::string opt;
+  while (std::getline(in, opt, ',')) {
+    auto eq = opt.find('=');
+    if (eq == std::string::npos)
+      throw std::invalid_argument("Sink option without value: " + opt);
+    s.options_[opt.substr(0, eq)] = opt.substr(eq + 1);
+  }
+
+  s.queue_size_ = option_ulong(s, "queue", DEFAULT_QUEUE_SIZE);
+  if (s.queue_size_ == 0)
+    throw std::invalid_argument("Sink queue size must be at least 1");
+
+  auto drop = s.options_.find("drop");
+  if (drop != s.options_.end()) {
+    if (drop->second == "oldest") {
+      s.drop_policy_ = DropPolicy::DROP_OLDEST;
+    } else if (drop->second != "newest") {
+      throw std::invalid_argument("Sink drop policy must be oldest or newest");
+    }
+  }
+
+  return s;
+}
+
+std::unique_ptr<ResultSink> make_result_sink(const SinkSetup& setup) {
+  auto sep = setup.uri_.find("://");
+  if (sep == std::string::npos)
+    throw std::invalid_argument("Sink URI without scheme: " + setup.uri_);
+
+  std::string scheme = setup.uri_.substr(0, sep);
+  std::string rest = setup.uri_.substr(sep + 3);
+
+  if ((scheme == "http") || (scheme == "https"))
+    return std::unique_ptr<ResultSink>(new HttpSink(setup.uri_));
+
+  if (scheme == "tcp")
+    return std::unique_ptr<ResultSink>(new StreamSink(rest, false));
+
+  if (scheme == "unix")
+    return std::unique_ptr<ResultSink>(new StreamSink(rest, true));
+
+  if (scheme == "shm") {
+    return std::unique_ptr<ResultSink>(new ShmSink("/" + rest,
+          option_ulong(setup, "slots", 32),
+          option_ulong(setup, "slot_size", 256 * 1024)));
+  }
+
+  throw std::invalid_argument("Unknown sink scheme: " + scheme);
+}
@@ -0,0 +1,51 @@
+#ifndef RESULT_SINK_H_
+#define RESULT_SINK_H_
+
+#include <map>
+#include <memory>
+#include <string>
+
+/* An encoded result (msgpack: JPEG, text, format, result points), shared
+ * between all sinks so it is only encoded once. */
+using Payload = std::string;
+using PayloadPtr = std::shared_ptr<const Payload>;
+
+enum class DropPolicy {
+  DROP_NEWEST, // keep what's queued, discard incoming results
+  DROP_OLDEST  // evict the oldest queued result
+};
+
+/* Parsed from a --sink argument of the form uri[,key=value...], e.g.
+ *
+ *   http://localhost:5000/post,queue=4
+ *   tcp://localhost:9000
+ *   unix:///run/zxwebcam.sock,drop=oldest
+ *   shm://zxwebcam,slots=32,slot_size=262144
+ */
+struct SinkSetup {
+  std::string uri_;
+  size_t queue_size_;
+  DropPolicy drop_policy_;
+  std::map<std::string, std::string> options_; // sink specific
+};
+
+/* Destination for scan results. Each sink runs on its own thread behind its
+ * own bounded queue, so a slow sink only drops its own results. */
+class ResultSink {
+  public:
+    virtual ~ResultSink() {};
+
+    virtual std::string name() const = 0;
+
+    // called from the sink's thread, returns false if delivery failed
+    virtual bool publish(const Payload& payload) = 0;
+};
+
+// throws std::invalid_argument on malformed arguments
+SinkSetup parse_sink_setup(const std::string& arg);
+
+// throws std::invalid_argument for unknown schemes, std::system_error if
+// the sink can't be set up
+std::unique_ptr<ResultSink> make_result_sink(const SinkSetup& setup);
+
+#endif
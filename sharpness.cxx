@@ -0,0 +1,23 @@
+#include "sharpness.h"
+
+uint32_t gradient_energy(const unsigned char* data, unsigned int rows,
+                         unsigned int cols, size_t row_bytes,
+                         unsigned int pixel_bytes) {
+  uint64_t sum = 0;
+  uint32_t n = 0;
+
+  for (unsigned int y = 0; y + 1 < rows; y += SHARPNESS_STEP) {
+    const unsigned char* row = data + y * row_bytes;
+    const unsigned char* below = row + row_bytes;
+
+    for (unsigned int x = 0; x + 1 < cols; x += SHARPNESS_STEP) {
+      const size_t i = static_cast<size_t>(x) * pixel_bytes;
+      int dx = row[i + pixel_bytes] - row[i];
+      int dy = below[i] - row[i];
+      sum += dx * dx + dy * dy;
+      n++;
+    }
+  }
+
+  return n ? static_cast<uint32_t>(sum / n) : 0;
+}
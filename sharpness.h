@@ -0,0 +1,22 @@
+#ifndef SHARPNESS_H_
+#define SHARPNESS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/* Focus score: mean squared horizontal plus vertical gradient over a grid
+ * of every SHARPNESS_STEP-th pixel in every SHARPNESS_STEP-th row. Motion
+ * blur and defocus flatten the gradients, so within one scene a higher
+ * score is a sharper frame. Scores of different scenes or lighting aren't
+ * comparable.
+ *
+ * pixel_bytes/row_bytes allow scoring one channel of interleaved data,
+ * e.g. the green byte of RGB24 at data + 1 with pixel_bytes 3.
+ */
+const unsigned int SHARPNESS_STEP = 4;
+
+uint32_t gradient_energy(const unsigned char* data, unsigned int rows,
+                         unsigned int cols, size_t row_bytes,
+                         unsigned int pixel_bytes);
+
+#endif
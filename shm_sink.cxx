@@ -0,0 +1,104 @@
+#include "shm_sink.h"
+#include "log_limit.h"
+
+#include <spdlog/spdlog.h>
+
+#include <cstring>
+#include <cerrno>
+#include <system_error>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "shm ring needs lock-free 64 bit atomics");
+
+// keep slots 8 byte aligned for the atomic sequence numbers
+static uint32_t slot_stride(uint32_t slot_size) {
+  return sizeof(ShmSlotHeader) + ((slot_size + 7) & ~7u);
+}
+
+ShmSink::ShmSink(std::string name, uint32_t slot_count, uint32_t slot_size):
+  name_(name),
+  slot_count_(slot_count),
+  slot_size_(slot_size),
+  map_size_(sizeof(ShmRingHeader) +
+            static_cast<size_t>(slot_count) * slot_stride(slot_size)),
+  map_(MAP_FAILED),
+  header_(nullptr) {
+
+  if (slot_count_ == 0)
+    throw std::invalid_argument("shm sink needs at least one slot");
+
+  int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    throw std::system_error(errno, std::generic_category(),
+            "Unable to open shared memory " + name_);
+  }
+
+  if (-1 == ftruncate(fd, map_size_)) {
+    int err = errno;
+    ::close(fd);
+    throw std::system_error(err, std::generic_category(),
+            "Unable to size shared memory " + name_);
+  }
+
+  map_ = mmap(NULL, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  int err = errno;
+  ::close(fd); // the mapping keeps the segment alive
+
+  if (map_ == MAP_FAILED) {
+    throw std::system_error(err, std::generic_category(),
+            "Unable to map shared memory " + name_);
+  }
+
+  // (re)initialise, readers check magic_ and version_ before trusting slots
+  std::memset(map_, 0, map_size_);
+  header_ = static_cast<ShmRingHeader*>(map_);
+  header_->version_ = SHM_RING_VERSION;
+  header_->slot_count_ = slot_count_;
+  header_->slot_size_ = slot_size_;
+  header_->write_seq_.store(0);
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->magic_ = SHM_RING_MAGIC;
+}
+
+ShmSink::~ShmSink() {
+  if (map_ != MAP_FAILED) {
+    munmap(map_, map_size_);
+    map_ = MAP_FAILED;
+  }
+  shm_unlink(name_.c_str());
+}
+
+ShmSlotHeader* ShmSink::slot(uint64_t n) {
+  char* base = static_cast<char*>(map_) + sizeof(ShmRingHeader);
+  return reinterpret_cast<ShmSlotHeader*>(
+      base + (n % slot_count_) * slot_stride(slot_size_));
+}
+
+bool ShmSink::publish(const Payload& payload) {
+  if (payload.size() > slot_size_) {
+    LOG_RATE_LIMITED(spdlog::get("console"), warn, 5000,
+                     "Result of {} bytes does not fit {} slot of {}",
+                     payload.size(), name(), slot_size_);
+    return false;
+  }
+
+  uint64_t n = header_->write_seq_.load(std::memory_order_relaxed);
+  ShmSlotHeader* s = slot(n);
+
+  s->seq_.store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  s->length_ = static_cast<uint32_t>(payload.size());
+  std::memcpy(reinterpret_cast<char*>(s + 1), payload.data(), payload.size());
+
+  s->seq_.store(2 * n + 2, std::memory_order_release);
+  header_->write_seq_.store(n + 1, std::memory_order_release);
+
+  return true;
+}
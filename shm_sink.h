@@ -0,0 +1,62 @@
+#ifndef SHM_SINK_H_
+#define SHM_SINK_H_
+
+#include "result_sink.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+static const uint32_t SHM_RING_MAGIC = 0x5a585752; // "ZXWR"
+static const uint32_t SHM_RING_VERSION = 1;
+
+/* Layout of the shared memory segment, readers map it read-only:
+ *
+ *   ShmRingHeader
+ *   slot_count_ x (ShmSlotHeader + slot_size_ payload bytes)
+ *
+ * Payload n (counting from 0) goes into slot n % slot_count_. Each slot is
+ * a seqlock: seq_ is 2n+1 while the writer copies payload n in and 2n+2 once
+ * it is complete. A reader wanting payload n copies it out and only uses it
+ * if seq_ read 2n+2 both before and after the copy. write_seq_ counts the
+ * published payloads, readers that fall more than slot_count_ behind have
+ * lost results. No syscalls are needed on the reader side.
+ */
+struct ShmRingHeader {
+  uint32_t magic_;
+  uint32_t version_;
+  uint32_t slot_count_;
+  uint32_t slot_size_;
+  std::atomic<uint64_t> write_seq_;
+};
+
+struct ShmSlotHeader {
+  std::atomic<uint64_t> seq_;
+  uint32_t length_;
+  uint32_t reserved_;
+};
+
+/* Publishes payloads into a POSIX shared memory ring for local readers */
+class ShmSink : public ResultSink {
+  public:
+    // name is the shm_open name, e.g. "/zxwebcam"
+    ShmSink(std::string name, uint32_t slot_count, uint32_t slot_size);
+    ~ShmSink();
+
+    ShmSink(const ShmSink&) = delete;
+    ShmSink& operator=(const ShmSink&) = delete;
+
+    std::string name() const override { return "shm://" + name_.substr(1); }
+    bool publish(const Payload& payload) override;
+  private:
+    ShmSlotHeader* slot(uint64_t n);
+
+    std::string name_;
+    uint32_t slot_count_;
+    uint32_t slot_size_;
+    size_t map_size_;
+    void* map_;
+    ShmRingHeader* header_;
+};
+
+#endif
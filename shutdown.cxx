@@ -0,0 +1,34 @@
+#include "shutdown.h"
+
+#include <cstdint>
+#include <cerrno>
+#include <system_error>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+Shutdown::Shutdown(): fd_{-1}, requested_{false} {
+  fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if (fd_ == -1) {
+    throw std::system_error(errno, std::generic_category(),
+            "Unable to create shutdown eventfd");
+  }
+}
+
+Shutdown::~Shutdown() {
+  if (fd_ != -1) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+void Shutdown::request() {
+  if (requested_.exchange(true))
+    return; // already signalled
+
+  // the counter is never read back so the fd stays readable for all waiters
+  uint64_t one = 1;
+  ssize_t r = write(fd_, &one, sizeof(one));
+  (void)r; // if this fails the flag is still set for pollers
+}
@@ -0,0 +1,30 @@
+#ifndef SHUTDOWN_H_
+#define SHUTDOWN_H_
+
+#include <atomic>
+
+/* Pipeline-wide shutdown request.
+ *
+ * Wraps an eventfd that becomes (and stays) readable once shutdown has been
+ * requested, so that any thread blocked in epoll/poll wakes immediately
+ * instead of waiting for a timeout. The atomic flag allows cheap polling
+ * from loops that don't block on file descriptors.
+ */
+class Shutdown {
+  public:
+    Shutdown(); // throws std::system_error if the eventfd can't be created
+    ~Shutdown();
+
+    Shutdown(const Shutdown&) = delete;
+    Shutdown& operator=(const Shutdown&) = delete;
+
+    void request(); // safe to call from any thread, more than once
+    bool requested() const { return requested_; }
+
+    int fd() const { return fd_; }
+  private:
+    int fd_;
+    std::atomic_bool requested_;
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include "stream_sink.h"
+
+#include <spdlog/spdlog.h>
+
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+static const auto RECONNECT_INTERVAL = std::chrono::seconds{1};
+static const int SEND_TIMEOUT_SECONDS = 1;
+
+static int connect_unix(const std::string& path) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+
+  if (-1 == connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+
+  return fd;
+}
+
+static int connect_tcp(const std::string& address) {
+  auto colon = address.rfind(':');
+  if (colon == std::string::npos) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  std::string host = address.substr(0, colon);
+  std::string port = address.substr(colon + 1);
+
+  // IPv6 literals come bracketed, [::1]:9000
+  if ((host.size() >= 2) && (host.front() == '[') && (host.back() == ']'))
+    host = host.substr(1, host.size() - 2);
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo* res = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+    errno = EHOSTUNREACH;
+    return -1;
+  }
+
+  int fd = -1;
+  for (addrinfo* ai = res; ai != nullptr; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd == -1)
+      continue;
+
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if (fd != -1) {
+    // length prefix and payload go out in one writev, don't wait for acks
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  return fd;
+}
+
+/* write the whole iovec array, handling partial writes */
+static bool write_all(int fd, iovec* iov, int iovcnt) {
+  while (iovcnt > 0) {
+    msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    while ((iovcnt > 0) && (static_cast<size_t>(n) >= iov->iov_len)) {
+      n -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+
+    if (iovcnt > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  return true;
+}
+
+StreamSink::StreamSink(std::string address, bool unix_socket):
+  address_(address),
+  unix_socket_(unix_socket),
+  fd_(-1),
+  next_connect_(std::chrono::steady_clock::now()) {
+}
+
+StreamSink::~StreamSink() {
+  disconnect();
+}
+
+std::string StreamSink::name() const {
+  return (unix_socket_ ? "unix://" : "tcp://") + address_;
+}
+
+bool StreamSink::connect_socket() {
+  auto now = std::chrono::steady_clock::now();
+  if (now < next_connect_)
+    return false;
+
+  next_connect_ = now + RECONNECT_INTERVAL;
+  fd_ = unix_socket_ ? connect_unix(address_) : connect_tcp(address_);
+
+  if (fd_ == -1) {
+    spdlog::get("console")->warn("Could not connect to {}: {}", name(),
+                                 strerror(errno));
+    return false;
+  }
+
+  // a stalled reader must not block the sink thread forever
+  timeval tv = {SEND_TIMEOUT_SECONDS, 0};
+  setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  spdlog::get("console")->info("Connected to {}", name());
+  return true;
+}
+
+void StreamSink::disconnect() {
+  if (fd_ != -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool StreamSink::publish(const Payload& payload) {
+  if ((fd_ == -1) && !connect_socket())
+    return false;
+
+  uint32_t length = htonl(static_cast<uint32_t>(payload.size()));
+  iovec iov[2] = {
+    {&length, sizeof(length)},
+    {const_cast<char*>(payload.data()), payload.size()}
+  };
+
+  if (!write_all(fd_, iov, 2)) {
+    spdlog::get("console")->warn("Lost connection to {}: {}", name(),
+                                 strerror(errno));
+    disconnect();
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,36 @@
+#ifndef STREAM_SINK_H_
+#define STREAM_SINK_H_
+
+#include "result_sink.h"
+
+#include <chrono>
+#include <string>
+
+/* Writes payloads to a persistent TCP or Unix domain socket connection.
+ *
+ * Each payload is prefixed with its length as a 32 bit big-endian integer.
+ * The connection is (re)established lazily, while the peer is unreachable
+ * payloads are dropped and reconnects are rate limited.
+ */
+class StreamSink : public ResultSink {
+  public:
+    // address is host:port for TCP, or a socket path when unix_socket is set
+    StreamSink(std::string address, bool unix_socket);
+    ~StreamSink();
+
+    StreamSink(const StreamSink&) = delete;
+    StreamSink& operator=(const StreamSink&) = delete;
+
+    std::string name() const override;
+    bool publish(const Payload& payload) override;
+  private:
+    bool connect_socket();
+    void disconnect();
+
+    std::string address_;
+    bool unix_socket_;
+    int fd_;
+    std::chrono::steady_clock::time_point next_connect_;
+};
+
+#endif
@@ -0,0 +1,262 @@
+#include "synthetic_thread.h"
+#include "trace.h"
+
+#include "BarcodeFormat.h"
+#include "BitMatrix.h"
+#include "MultiFormatWriter.h"
+
+#include <spdlog/spdlog.h>
+#include <CImg.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace cimg_library;
+
+static const int MAX_QUEUE_DEPTH = 4; // enough to keep decode busy
+static const float DEG_TO_RAD = 3.14159265f / 180;
+static const auto POLL_INTERVAL = std::chrono::milliseconds{1};
+static const auto DRAIN_TIMEOUT = std::chrono::seconds{5};
+
+struct Variant {
+  std::vector<unsigned char> rgb_;
+  std::string format_;
+  std::string text_; // empty = no barcode
+};
+
+static double option_number(const std::map<std::string, std::string>& opts,
+                            const std::string& key, double def) {
+  auto it = opts.find(key);
+  if (it == opts.end())
+    return def;
+
+  try {
+    return std::stod(it->second);
+  } catch (const std::logic_error&) {
+    throw std::invalid_argument("Invalid value for synthetic option " + key);
+  }
+}
+
+/* option_number() for the unsigned fields, negative values would wrap */
+static double option_count(const std::map<std::string, std::string>& opts,
+                           const std::string& key, double def, double max) {
+  double v = option_number(opts, key, def);
+  if (!(v >= 0) || (v > max))
+    throw std::invalid_argument("Synthetic option " + key +
+                                " must be a non-negative number");
+  return v;
+}
+
+void parse_synthetic_setup(const std::string& arg, SyntheticSetup& ss) {
+  std::map<std::string, std::string> opts;
+
+  std::istringstream in(arg);
+  std::string opt;
+  while (std::getline(in, opt, ',')) {
+    auto eq = opt.find('=');
+    if (eq == std::string::npos)
+      throw std::invalid_argument("Synthetic option without value: " + opt);
+    opts[opt.substr(0, eq)] = opt.substr(eq + 1);
+  }
+
+  const double max_uint = std::numeric_limits<unsigned int>::max();
+  const double max_ulong = std::numeric_limits<unsigned long>::max();
+
+  ss.size_ = option_count(opts, "size", ss.size_, max_uint);
+  ss.rotation_ = option_number(opts, "rotate", ss.rotation_);
+  ss.blur_ = option_number(opts, "blur", ss.blur_);
+  ss.noise_ = option_number(opts, "noise", ss.noise_);
+  ss.contrast_ = option_number(opts, "contrast", ss.contrast_);
+  ss.empty_fraction_ = option_number(opts, "empty", ss.empty_fraction_);
+  ss.fps_ = option_count(opts, "fps", ss.fps_, max_uint);
+  ss.frames_ = option_count(opts, "frames", ss.frames_, max_ulong);
+  ss.variants_ = option_count(opts, "variants", ss.variants_, max_uint);
+  ss.seed_ = option_count(opts, "seed", ss.seed_, max_uint);
+}
+
+void validate_synthetic_setup(const SyntheticSetup& ss) {
+  if ((ss.size_ == 0) || (ss.size_ > std::min(ss.res_x_, ss.res_y_)))
+    throw std::invalid_argument("Synthetic barcode size must fit the frame");
+  if ((ss.contrast_ < 0) || (ss.contrast_ > 1))
+    throw std::invalid_argument("Synthetic contrast must be within 0..1");
+  if ((ss.empty_fraction_ < 0) || (ss.empty_fraction_ > 1))
+    throw std::invalid_argument("Synthetic empty fraction must be within 0..1");
+  if ((ss.blur_ < 0) || (ss.noise_ < 0))
+    throw std::invalid_argument("Synthetic blur and noise can't be negative");
+  if (ss.variants_ == 0)
+    throw std::invalid_argument("Synthetic variants must be at least 1");
+}
+
+/* EAN check digit over the leading digits */
+static char ean_check_digit(const std::string& digits) {
+  int sum = 0;
+  for (size_t i = 0; i < digits.size(); i++) {
+    int weight = ((digits.size() - i) % 2) ? 3 : 1;
+    sum += (digits[i] - '0') * weight;
+  }
+  return '0' + (10 - sum % 10) % 10;
+}
+
+/* content the format can encode, as the reader will return it */
+static std::string make_text(const std::string& format, unsigned int serial,
+                             std::mt19937& rng) {
+  std::uniform_int_distribution<int> digit(0, 9);
+  auto digits = [&](size_t n) {
+    std::string s;
+    for (size_t i = 0; i < n; i++) s += static_cast<char>('0' + digit(rng));
+    return s;
+  };
+
+  if (format == "EAN_8") {
+    auto s = digits(7);
+    return s + ean_check_digit(s);
+  }
+  if (format == "EAN_13") {
+    auto s = digits(12);
+    return s + ean_check_digit(s);
+  }
+  if (format == "CODABAR") return digits(8); // start/stop added by the writer
+  if (format == "CODE_39") return "ZXW" + digits(6);
+  if (format == "CODE_128") return "zxw-" + digits(6);
+  return "zxwebcam synthetic " + std::to_string(serial) + " " + digits(6);
+}
+
+static Variant render_variant(const SyntheticSetup& ss, unsigned int serial,
+                              std::mt19937& rng) {
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  Variant v;
+
+  // grey levels straddling mid grey, 1.0 contrast = 0 and 255
+  const float half = 127.5f * ss.contrast_;
+  const unsigned char bg = static_cast<unsigned char>(127.5f + half);
+  const unsigned char fg = static_cast<unsigned char>(127.5f - half);
+
+  CImg<unsigned char> img(ss.res_x_, ss.res_y_, 1, 1);
+  img.fill(bg);
+
+  if (unit(rng) >= ss.empty_fraction_) {
+    v.format_ = ss.formats_[serial % ss.formats_.size()];
+    v.text_ = make_text(v.format_, serial, rng);
+
+    auto fmt = ZXing::BarcodeFormatFromString(v.format_);
+    bool two_d = (fmt == ZXing::BarcodeFormat::QR_CODE);
+    int w = ss.size_;
+    int h = two_d ? ss.size_ : ss.size_ / 2;
+
+    ZXing::MultiFormatWriter writer(fmt);
+    auto matrix = writer.encode(std::wstring(v.text_.begin(), v.text_.end()),
+                                w, h);
+
+    // random placement that keeps the unrotated code inside the frame
+    float angle = (2 * unit(rng) - 1) * ss.rotation_ * DEG_TO_RAD;
+    float cx = w / 2.0f + unit(rng) * (ss.res_x_ - w);
+    float cy = h / 2.0f + unit(rng) * (ss.res_y_ - h);
+    float c = std::cos(angle), s = std::sin(angle);
+
+    // inverse map every frame pixel into the module matrix
+    for (unsigned int y = 0; y < ss.res_y_; y++) {
+      for (unsigned int x = 0; x < ss.res_x_; x++) {
+        float dx = x - cx, dy = y - cy;
+        int mx = static_cast<int>(std::floor(c * dx + s * dy + matrix.width() / 2.0f));
+        int my = static_cast<int>(std::floor(-s * dx + c * dy + matrix.height() / 2.0f));
+        if ((mx >= 0) && (my >= 0) && (mx < matrix.width()) &&
+            (my < matrix.height()) && matrix.get(mx, my)) {
+          img(x, y) = fg;
+        }
+      }
+    }
+  }
+
+  if (ss.blur_ > 0) { img.blur(ss.blur_); }
+  if (ss.noise_ > 0) { img.noise(ss.noise_, 0); } // gaussian, clamped
+
+  // RGB24 like a camera, so the luma conversion is part of the workload
+  v.rgb_.resize(static_cast<size_t>(ss.res_x_) * ss.res_y_ * 3);
+  for (unsigned int y = 0, i = 0; y < ss.res_y_; y++) {
+    for (unsigned int x = 0; x < ss.res_x_; x++, i += 3) {
+      v.rgb_[i] = v.rgb_[i + 1] = v.rgb_[i + 2] = img(x, y);
+    }
+  }
+
+  return v;
+}
+
+void synthetic_thread(SyntheticSetup ss, ThreadsafeQueue<FramePtr>& queue,
+                      GroundTruth& truth, MemoryBudget& budget,
+                      Shutdown& shutdown) {
+
+  auto logger = spdlog::get("console");
+  TRACE_THREAD("synthetic");
+
+  std::mt19937 rng(ss.seed_);
+  std::vector<Variant> variants;
+
+  logger->info("Rendering {} synthetic frames {}x{}, barcode {}px, rotation "
+               "{}, blur {}, noise {}, contrast {}, empty {}", ss.variants_,
+               ss.res_x_, ss.res_y_, ss.size_, ss.rotation_, ss.blur_,
+               ss.noise_, ss.contrast_, ss.empty_fraction_);
+  try {
+    for (unsigned int n = 0; n < ss.variants_; n++) {
+      variants.push_back(render_variant(ss, n, rng));
+    }
+  } catch (const std::exception& e) {
+    logger->error("Could not render synthetic frames: <{}>", e.what());
+    shutdown.request();
+    return;
+  }
+
+  auto interval = std::chrono::microseconds{ss.fps_ ? 1000000 / ss.fps_ : 0};
+  auto next_time = std::chrono::steady_clock::now();
+  unsigned long generated = 0;
+  // like the capture loop, at a fixed rate up to a second of frames queue up
+  const int max_queue = std::max<int>(MAX_QUEUE_DEPTH, ss.fps_);
+
+  while (!shutdown.requested() &&
+         ((ss.frames_ == 0) || (generated < ss.frames_))) {
+    if (ss.fps_ > 0) {
+      next_time += interval;
+      std::this_thread::sleep_until(next_time);
+    }
+
+    bool full = (queue.size() >= max_queue) || budget.exceeded();
+    if (full && (ss.fps_ == 0)) {
+      std::this_thread::sleep_for(POLL_INTERVAL);
+      continue;
+    }
+
+    auto& v = variants[generated++ % variants.size()];
+    if (full) {
+      // fixed rate the decoder can't keep up with, never queued so the
+      // drain below doesn't wait for it
+      truth.lose(1);
+      continue;
+    }
+
+    auto f = std::make_shared<Frame>(v.rgb_.data(), v.rgb_.size(), ss.res_y_,
+                                     ss.res_x_, FrameFormat::RGB24);
+    f->set_budget(&budget);
+    truth.expect(f->id(), v.format_, v.text_);
+
+    TRACE_SPAN("enqueue", f->id());
+    queue.push(f);
+  }
+
+  if (shutdown.requested()) return;
+
+  // let the decoder finish the last frames before stopping the pipeline
+  auto deadline = std::chrono::steady_clock::now() + DRAIN_TIMEOUT;
+  while (!shutdown.requested() && (truth.pending() > 0) &&
+         (std::chrono::steady_clock::now() < deadline)) {
+    std::this_thread::sleep_for(POLL_INTERVAL);
+  }
+
+  logger->info("Generated {} synthetic frames", generated);
+  shutdown.request();
+}
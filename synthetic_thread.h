@@ -0,0 +1,54 @@
+#ifndef SYNTHETIC_THREAD_H_
+#define SYNTHETIC_THREAD_H_
+
+#include "frame.h"
+#include "threadsafe_queue.h"
+#include "shutdown.h"
+#include "memory_budget.h"
+#include "ground_truth.h"
+
+#include <string>
+#include <vector>
+
+/* Parsed from a --synthetic-opts argument of the form key=value[,...], e.g.
+ *
+ *   size=160,rotate=15,blur=1.5,noise=10,contrast=0.5,empty=0.2,frames=2000
+ */
+struct SyntheticSetup {
+  std::vector<std::string> formats_; // rendered in turn, names as in main
+  unsigned int res_x_;
+  unsigned int res_y_;
+  unsigned int size_;     // barcode width in pixels (1D codes are half as high)
+  float rotation_;        // max rotation in degrees, random in [-r, r]
+  float blur_;            // gaussian blur sigma, 0 = sharp
+  float noise_;           // gaussian noise sigma in grey levels
+  float contrast_;        // 1 = black on white, 0 = invisible
+  float empty_fraction_;  // share of frames without a barcode
+  unsigned int fps_;      // 0 = as fast as the decoder takes them
+  unsigned long frames_;  // stop after this many, 0 = until interrupted
+  unsigned int variants_; // distinct frames rendered up front
+  unsigned int seed_;
+};
+
+// throws std::invalid_argument on malformed arguments
+void parse_synthetic_setup(const std::string& arg, SyntheticSetup& setup);
+
+/* Throws std::invalid_argument if the setup can't be rendered, e.g. a
+ * barcode larger than the frame. Needed with or without --synthetic-opts,
+ * the defaults may not fit a small -x/-y.
+ */
+void validate_synthetic_setup(const SyntheticSetup& setup);
+
+/* Generate frames with known content into queue instead of capturing.
+ *
+ * A pool of variants is rendered up front (random placement, rotation and
+ * text per variant, then blur, noise and contrast) so generating doesn't
+ * compete with decoding; frames are copied from the pool and their content
+ * recorded in truth for the decode thread to check. Requests shutdown once
+ * frames_ frames have been decoded.
+ */
+void synthetic_thread(SyntheticSetup ss, ThreadsafeQueue<FramePtr>& queue,
+                      GroundTruth& truth, MemoryBudget& budget,
+                      Shutdown& shutdown);
+
+#endif
@@ -0,0 +1,117 @@
+#include "thread_placement.h"
+
+#include <spdlog/spdlog.h>
+
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+static int to_native_policy(SchedPolicy p) {
+  switch (p) {
+    case SchedPolicy::FIFO: return SCHED_FIFO;
+    case SchedPolicy::RR: return SCHED_RR;
+    default: return SCHED_OTHER;
+  }
+}
+
+static const char* policy_name(int policy) {
+  switch (policy) {
+    case SCHED_FIFO: return "SCHED_FIFO";
+    case SCHED_RR: return "SCHED_RR";
+    case SCHED_OTHER: return "SCHED_OTHER";
+    default: return "unknown";
+  }
+}
+
+bool SchedPolicyFromString(const std::string& s, SchedPolicy& policy) {
+  if (s == "other") {
+    policy = SchedPolicy::OTHER;
+  } else if (s == "fifo") {
+    policy = SchedPolicy::FIFO;
+  } else if (s == "rr") {
+    policy = SchedPolicy::RR;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static std::string describe_placement(pthread_t handle) {
+  std::ostringstream out;
+
+  char name[16] = {};
+  if (pthread_getname_np(handle, name, sizeof(name)) == 0)
+    out << name << ":";
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (pthread_getaffinity_np(handle, sizeof(cpus), &cpus) == 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    out << " cpus [";
+    bool first = true;
+    for (long c = 0; c < ncpu && c < CPU_SETSIZE; c++) {
+      if (CPU_ISSET(c, &cpus)) {
+        out << (first ? "" : ",") << c;
+        first = false;
+      }
+    }
+    out << "]";
+  }
+
+  int policy = 0;
+  sched_param param = {};
+  if (pthread_getschedparam(handle, &policy, &param) == 0) {
+    out << " " << policy_name(policy);
+    if (policy != SCHED_OTHER)
+      out << " prio " << param.sched_priority;
+  }
+
+  return out.str();
+}
+
+std::string apply_thread_placement(std::thread& t, const ThreadPlacement& tp) {
+  auto logger = spdlog::get("console");
+  pthread_t handle = t.native_handle();
+  int r = 0;
+
+  if (!tp.name_.empty()) {
+    // kernel limit is 16 bytes including the terminator
+    r = pthread_setname_np(handle, tp.name_.substr(0, 15).c_str());
+    if (r != 0)
+      logger->warn("Could not name thread {}: {}", tp.name_, strerror(r));
+  }
+
+  if (tp.cpu_ >= CPU_SETSIZE) {
+    logger->warn("Could not pin {} to cpu {}: beyond CPU_SETSIZE ({})",
+                 tp.name_, tp.cpu_, CPU_SETSIZE);
+  } else if (tp.cpu_ >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(tp.cpu_, &cpus);
+
+    r = pthread_setaffinity_np(handle, sizeof(cpus), &cpus);
+    if (r != 0)
+      logger->warn("Could not pin {} to cpu {}: {}", tp.name_, tp.cpu_,
+                   strerror(r));
+  }
+
+  if (tp.policy_ != SchedPolicy::OTHER) {
+    sched_param param = {};
+    param.sched_priority = tp.priority_;
+
+    r = pthread_setschedparam(handle, to_native_policy(tp.policy_), &param);
+    if (r == EPERM) {
+      logger->warn("No permission for real-time scheduling of {} "
+                   "(needs CAP_SYS_NICE or RLIMIT_RTPRIO)", tp.name_);
+    } else if (r != 0) {
+      logger->warn("Could not set scheduling policy of {}: {}", tp.name_,
+                   strerror(r));
+    }
+  }
+
+  return describe_placement(handle);
+}
@@ -0,0 +1,30 @@
+#ifndef THREAD_PLACEMENT_H_
+#define THREAD_PLACEMENT_H_
+
+#include <string>
+#include <thread>
+
+enum class SchedPolicy {
+  OTHER, // default time-sharing scheduler
+  FIFO,
+  RR
+};
+
+struct ThreadPlacement {
+  std::string name_; // shown in top/perf, truncated to 15 chars
+  int cpu_;          // core to pin to, -1 leaves the affinity alone
+  SchedPolicy policy_;
+  int priority_;     // real-time priority, ignored for SchedPolicy::OTHER
+};
+
+/* Name, pin and set the scheduling policy of a running thread.
+ *
+ * Failures (e.g. EPERM for real-time policies without CAP_SYS_NICE) are
+ * logged and otherwise ignored. Returns a description of the placement that
+ * is actually in effect, read back from the kernel.
+ */
+std::string apply_thread_placement(std::thread& t, const ThreadPlacement& tp);
+
+bool SchedPolicyFromString(const std::string& s, SchedPolicy& policy);
+
+#endif
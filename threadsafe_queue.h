@@ -13,7 +13,7 @@
 template<typename T>
 class ThreadsafeQueue {
   public:
-    ThreadsafeQueue() {};
+    ThreadsafeQueue(): closed_{false} {};
     virtual ~ThreadsafeQueue() {};
 
     void push(T p) {
@@ -22,12 +22,34 @@ class ThreadsafeQueue {
       cond_.notify_one();
     };
 
+    /* push unless the queue already holds capacity items, in which case
+     * either the oldest item is evicted to make room or p is dropped.
+     * Returns false if anything was dropped. */
+    bool push_bounded(T p, size_t capacity, bool drop_oldest) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (data_.size() < capacity) {
+        data_.push(p);
+        cond_.notify_one();
+        return true;
+      }
+
+      if (drop_oldest && !data_.empty()) {
+        data_.pop();
+        data_.push(p);
+        cond_.notify_one();
+      }
+      return false;
+    };
+
+    /* returns T() once the queue has been closed */
     T wait_and_pop() {
       std::unique_lock<std::mutex> lock(mutex_);
-      while(data_.empty()) {
+      while(data_.empty() && !closed_) {
         cond_.wait(lock);
       }
 
+      if (closed_) { return T(); }
+
       T p = data_.front();
       data_.pop();
       return p;
@@ -35,18 +57,32 @@ class ThreadsafeQueue {
 
     T pop_with_timeout(int timeout) {
       std::unique_lock<std::mutex> lock(mutex_);
-      while(data_.empty()) {
+      while(data_.empty() && !closed_) {
         auto r = cond_.wait_for(lock, std::chrono::seconds(timeout));
         if (r == std::cv_status::timeout) {
           return T();
         }
       }
 
+      if (closed_) { return T(); }
+
       T p = data_.front();
       data_.pop();
       return p;
     };
 
+    /* wake all waiting consumers, used on shutdown */
+    void close() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+      cond_.notify_all();
+    };
+
+    bool closed() const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return closed_;
+    };
+
     int size() const {
       std::lock_guard<std::mutex> lock(mutex_);
       return data_.size();
@@ -55,6 +91,7 @@ class ThreadsafeQueue {
     mutable std::mutex mutex_;
     std::queue<T> data_;
     std::condition_variable cond_;
+    bool closed_;
 };
 
 
@@ -0,0 +1,140 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <cerrno>
+#include <system_error>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace trace_detail {
+  std::atomic_bool enabled{false};
+}
+
+namespace {
+
+struct TraceEvent {
+  const char* name_;
+  uint64_t frame_id_;
+  int64_t start_us_; // since trace_start()
+  int64_t dur_us_;
+};
+
+/* single writer (the owning thread), read after that thread has stopped */
+struct TraceBuffer {
+  std::string name_;
+  long tid_;
+  std::unique_ptr<TraceEvent[]> events_;
+  size_t capacity_;
+  std::atomic<size_t> count_; // total recorded, wraps around events_
+};
+
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<TraceBuffer>> registry;
+size_t buffer_events = 0;
+std::chrono::steady_clock::time_point epoch;
+
+thread_local TraceBuffer* local_buffer = nullptr;
+
+TraceBuffer* thread_buffer() {
+  if (local_buffer != nullptr) return local_buffer;
+
+  std::unique_ptr<TraceBuffer> b(new TraceBuffer());
+  b->tid_ = syscall(SYS_gettid);
+  b->name_ = "thread " + std::to_string(b->tid_);
+  b->capacity_ = buffer_events;
+  b->events_.reset(new TraceEvent[b->capacity_]);
+  b->count_ = 0;
+
+  std::lock_guard<std::mutex> lk(registry_mutex);
+  local_buffer = b.get();
+  registry.push_back(std::move(b));
+  return local_buffer;
+}
+
+int64_t since_epoch_us(std::chrono::steady_clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(t - epoch).count();
+}
+
+/* names are identifiers and literals, only quotes and backslashes need
+ * escaping */
+std::string json_escape(const std::string& s) {
+  std::string out;
+  for (char c : s) {
+    if ((c == '"') || (c == '\\')) out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+}
+
+void trace_start(size_t events_per_thread) {
+  buffer_events = std::max<size_t>(1, events_per_thread);
+  epoch = std::chrono::steady_clock::now();
+  trace_detail::enabled.store(true);
+}
+
+void trace_thread_name(const std::string& name) {
+  thread_buffer()->name_ = name;
+}
+
+void TraceSpan::record() {
+  TraceBuffer* b = thread_buffer();
+  size_t n = b->count_.load(std::memory_order_relaxed);
+
+  TraceEvent& e = b->events_[n % b->capacity_];
+  e.name_ = name_;
+  e.frame_id_ = frame_id_;
+  e.start_us_ = since_epoch_us(start_);
+  e.dur_us_ = std::chrono::duration_cast<std::chrono::microseconds>(
+      end_ - start_).count();
+
+  b->count_.store(n + 1, std::memory_order_release);
+}
+
+void trace_write(const std::string& path) {
+  std::FILE* fp = std::fopen(path.c_str(), "w");
+  if (fp == nullptr) {
+    throw std::system_error(errno, std::generic_category(),
+                            "Unable to open trace file " + path);
+  }
+
+  const int pid = getpid();
+  bool first = true;
+  auto sep = [&]() { std::fputs(first ? "\n" : ",\n", fp); first = false; };
+
+  std::fputs("{\"traceEvents\":[", fp);
+
+  std::lock_guard<std::mutex> lk(registry_mutex);
+  for (auto& b : registry) {
+    sep();
+    std::fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                 "\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                 pid, b->tid_, json_escape(b->name_).c_str());
+
+    size_t count = b->count_.load(std::memory_order_acquire);
+    size_t first_event = (count > b->capacity_) ? count - b->capacity_ : 0;
+
+    for (size_t n = first_event; n < count; n++) {
+      const TraceEvent& e = b->events_[n % b->capacity_];
+      sep();
+      std::fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,"
+                   "\"ts\":%lld,\"dur\":%lld,\"args\":{\"frame\":%llu}}",
+                   json_escape(e.name_).c_str(), pid, b->tid_,
+                   static_cast<long long>(e.start_us_),
+                   static_cast<long long>(e.dur_us_),
+                   static_cast<unsigned long long>(e.frame_id_));
+    }
+  }
+
+  std::fputs("\n],\"displayTimeUnit\":\"ms\"}\n", fp);
+
+  if (std::fclose(fp) != 0) {
+    throw std::system_error(errno, std::generic_category(),
+                            "Unable to write trace file " + path);
+  }
+}
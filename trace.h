@@ -0,0 +1,102 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/* Per-frame span tracing, exported in Chrome trace-event format (load the
+ * file in chrome://tracing or ui.perfetto.dev).
+ *
+ * Every thread records into its own fixed size ring of events, appending
+ * is a couple of stores without locks or allocation; the ring is only read
+ * by trace_write() after the pipeline threads have been joined. Spans carry
+ * the id of the frame they worked on, so a stall can be followed from
+ * DQBUF to the sink. When tracing is compiled in but not started a span
+ * costs one relaxed atomic load, building without ZXWEBCAM_TRACING removes
+ * the macros altogether.
+ */
+
+namespace trace_detail {
+  extern std::atomic_bool enabled;
+}
+
+inline bool trace_enabled() {
+  return trace_detail::enabled.load(std::memory_order_relaxed);
+}
+
+/* start recording, keeping the latest events_per_thread per thread */
+void trace_start(size_t events_per_thread);
+
+/* label the calling thread in the trace */
+void trace_thread_name(const std::string& name);
+
+/* write everything recorded so far as JSON, call once all traced threads
+ * have stopped. Throws std::system_error if the file can't be written. */
+void trace_write(const std::string& path);
+
+/* RAII span, recorded when it goes out of scope */
+class TraceSpan {
+  public:
+    TraceSpan(const char* name, uint64_t frame_id):
+      name_(name),
+      frame_id_(frame_id),
+      active_(trace_enabled()),
+      stopped_(false) {
+      if (active_) { start_ = std::chrono::steady_clock::now(); }
+    }
+
+    ~TraceSpan() {
+      if (!active_) return;
+      if (!stopped_) { end_ = std::chrono::steady_clock::now(); }
+      record();
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    /* frame id not known until later in the span */
+    void set_frame(uint64_t frame_id) { frame_id_ = frame_id; }
+
+    /* end the span now, but keep it open for set_frame() */
+    void stop() {
+      if (!active_ || stopped_) return;
+      end_ = std::chrono::steady_clock::now();
+      stopped_ = true;
+    }
+
+    /* don't record this span */
+    void cancel() { active_ = false; }
+  private:
+    void record();
+
+    const char* name_; // must be a string literal
+    uint64_t frame_id_;
+    bool active_;
+    bool stopped_;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::time_point end_;
+};
+
+#ifdef ZXWEBCAM_TRACING
+#define TRACE_CONCAT_(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(name, frame_id) \
+  TraceSpan TRACE_CONCAT(trace_span_, __LINE__)((name), (frame_id))
+#define TRACE_SCOPE(var, name) TraceSpan var((name), 0)
+#define TRACE_FRAME(var, frame_id) (var).set_frame(frame_id)
+#define TRACE_STOP(var) (var).stop()
+#define TRACE_CANCEL(var) (var).cancel()
+#define TRACE_THREAD(name) \
+  do { if (trace_enabled()) { trace_thread_name(name); } } while (0)
+#else
+#define TRACE_SPAN(name, frame_id) do {} while (0)
+#define TRACE_SCOPE(var, name) do {} while (0)
+#define TRACE_FRAME(var, frame_id) do {} while (0)
+#define TRACE_STOP(var) do {} while (0)
+#define TRACE_CANCEL(var) do {} while (0)
+#define TRACE_THREAD(name) do {} while (0)
+#endif
+
+#endif
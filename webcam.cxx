@@ -1,4 +1,6 @@
 #include "webcam.h"
+#include "trace.h"
+#include "sharpness.h"
 
 #include <linux/videodev2.h>
 #include <libv4l2.h>
@@ -34,7 +36,8 @@ Webcam::Webcam(std::string& device,
     unsigned int cap_height,
     unsigned int cap_width,
     unsigned int fps,
-    unsigned int buffer_count):
+    unsigned int buffer_count,
+    CaptureFormat format):
   fd_{-1},
   is_streaming_{false},
   device_{device},
@@ -43,9 +46,10 @@ Webcam::Webcam(std::string& device,
   cap_height_{cap_height},
   fps_{fps},
   buffer_count_{buffer_count},
-  // this is a supported format from libv4l2 which should convert if
-  // not natively supported by the camera
-  pixel_format_{V4L2_PIX_FMT_RGB24},
+  // RGB24 is a supported format from libv4l2 which should convert if
+  // not natively supported by the camera, MJPEG must be native
+  pixel_format_{format == CaptureFormat::MJPEG ? V4L2_PIX_FMT_MJPEG
+                                               : V4L2_PIX_FMT_RGB24},
   buffers_{nullptr} {
 }
 
@@ -109,6 +113,9 @@ void Webcam::init() {
     throw std::system_error(errno, std::generic_category(),
         "Unable to set device format.");
 
+  if (vfmt.fmt.pix.pixelformat != pixel_format_)
+    throw std::runtime_error("Device does not support the requested pixel format.");
+
   if ((cap_width_ != vfmt.fmt.pix.width) ||
       (cap_height_ != vfmt.fmt.pix.height)) {
     cap_width_ = vfmt.fmt.pix.width;
@@ -118,6 +125,14 @@ void Webcam::init() {
         cap_height_);
   }
 
+  apply_fps();
+
+  init_mmap();
+
+  logger_->debug("Initialised {}", device_);
+}
+
+void Webcam::apply_fps() {
   v4l2_streamparm sparm = {};
   sparm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   sparm.parm.capture.timeperframe = {1, fps_};
@@ -127,10 +142,29 @@ void Webcam::init() {
 
   logger_->debug("FPS {}/{}", sparm.parm.capture.timeperframe.denominator,
                  sparm.parm.capture.timeperframe.numerator);
+}
 
-  init_mmap();
+void Webcam::set_fps(unsigned int fps) {
+  unsigned int old_fps = fps_;
+  fps_ = fps;
 
-  logger_->debug("Initialised {}", device_);
+  if (fd_ == -1)
+    return;
+
+  try {
+    apply_fps();
+  } catch (const std::system_error&) {
+    fps_ = old_fps; // device keeps running at the old rate
+    throw;
+  }
+}
+
+void Webcam::set_resolution(unsigned int width, unsigned int height) {
+  if (fd_ != -1)
+    throw std::runtime_error("Cannot change resolution of an open device");
+
+  cap_width_ = width;
+  cap_height_ = height;
 }
 
 void Webcam::init_mmap() {
@@ -224,7 +258,7 @@ void Webcam::start_capture() {
 }
 
 void Webcam::end_capture() {
-  v4l2_buf_type type;
+  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
   if (-1 == xioctl(fd_, VIDIOC_STREAMOFF, &type)) {
     throw std::system_error(errno, std::generic_category(),
@@ -236,39 +270,98 @@ void Webcam::end_capture() {
   logger_->debug("Ending capture on {}", device_);
 }
 
-std::shared_ptr<Frame> Webcam::grab_frame() {
-  // Refactor?: return a SharedPtr to a CamFrame obj that is composed
-  // of a blob and timestamp. Nullptr return on EAGAIN.
-  v4l2_buffer buf = {};
+bool Webcam::dequeue(v4l2_buffer& buf) {
   buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   buf.memory = V4L2_MEMORY_MMAP;
       
   if (-1 == xioctl(fd_, VIDIOC_DQBUF, &buf)) {
      switch(errno) {
       case EAGAIN:
-        return nullptr; // Nonblocking read
+        return false; // Nonblocking read
       default:
         throw std::system_error(errno,
                 std::system_category(),
                 "Unable to dequeue buffer from device.");
      }
   }
+
+  return true;
+}
+
+void Webcam::requeue(v4l2_buffer& buf) {
+  if (-1 == xioctl(fd_, VIDIOC_QBUF, &buf)) {
+    throw std::system_error(errno,
+             std::system_category(),
+             "Unable to requeue frame.");
+  }
+}
+
+std::shared_ptr<Frame> Webcam::grab_frame() {
+  // Refactor?: return a SharedPtr to a CamFrame obj that is composed
+  // of a blob and timestamp. Nullptr return on EAGAIN.
+  v4l2_buffer buf = {};
+
+  TRACE_SCOPE(dqbuf_span, "dqbuf");
+  if (!dequeue(buf)) {
+    TRACE_CANCEL(dqbuf_span);
+    return nullptr;
+  }
+  TRACE_STOP(dqbuf_span);
   
+  TRACE_SCOPE(copy_span, "copy");
   auto f = std::make_shared<Frame>((unsigned char*)(buffers_[buf.index].start_),
                                    buf.bytesused,
                                    cap_height_,
                                    cap_width_,
-                                   FrameFormat::RGB24);
+                                   pixel_format_ == V4L2_PIX_FMT_MJPEG ?
+                                     FrameFormat::JPEG : FrameFormat::RGB24);
+  TRACE_FRAME(dqbuf_span, f->id());
+  TRACE_FRAME(copy_span, f->id());
+  TRACE_STOP(copy_span);
     
   // enqueue the frame again
-  if (-1 == xioctl(fd_, VIDIOC_QBUF, &buf)) {
-    throw std::system_error(errno,
-             std::system_category(),
-             "Unable to requeue frame.");
-  }
+  TRACE_SPAN("qbuf", f->id());
+  requeue(buf);
   return f;
 }
 
+bool Webcam::discard_frame() {
+  v4l2_buffer buf = {};
+
+  if (!dequeue(buf))
+    return false;
+
+  requeue(buf);
+  return true;
+}
+
+bool Webcam::grab_if_sharper(std::shared_ptr<Frame>& best,
+                             uint32_t& best_score) {
+  v4l2_buffer buf = {};
+
+  if (!dequeue(buf))
+    return false;
+
+  const unsigned char* data =
+    static_cast<const unsigned char*>(buffers_[buf.index].start_);
+  bool jpeg = (pixel_format_ == V4L2_PIX_FMT_MJPEG);
+
+  uint32_t score = jpeg ? buf.bytesused
+                        : gradient_energy(data + 1, cap_height_, cap_width_,
+                                          cap_width_ * 3, 3);
+
+  if ((best == nullptr) || (score > best_score)) {
+    TRACE_SCOPE(copy_span, "copy");
+    best = std::make_shared<Frame>(data, buf.bytesused, cap_height_, cap_width_,
+                                   jpeg ? FrameFormat::JPEG : FrameFormat::RGB24);
+    TRACE_FRAME(copy_span, best->id());
+    best_score = score;
+  }
+
+  requeue(buf);
+  return true;
+}
+
 int Webcam::fd() const {
   return fd_;
 }
@@ -281,6 +374,10 @@ unsigned int Webcam::cap_width() const {
   return cap_width_;
 }
 
+unsigned int Webcam::fps() const {
+  return fps_;
+}
+
 bool Webcam::check_capabilities() {
   v4l2_capability cap = {};
 
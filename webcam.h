@@ -8,8 +8,15 @@
 #include <memory>
 #include <stdexcept>
 
+struct v4l2_buffer;
+
 namespace zxwebcam {
 
+/*! \brief Pixel format requested from the device */
+enum class CaptureFormat {
+  RGB24, /*!< converted by libv4l2 if the camera doesn't support it */
+  MJPEG  /*!< compressed frames passed through as FrameFormat::JPEG */
+};
  
 /*! \brief Struct to hold memory mappings for allocated V4L buffers
  * (in kernel memory).
@@ -43,6 +50,9 @@ class Webcam {
     bool check_capabilities(); /*!< check that the device fulfills min reqs */
     void init_mmap(); /*!< initialise memory mappings */
     void deinit_mmap(); /*!< unmap any active memory mappings */
+    void apply_fps(); /*!< set fps_ on the device via VIDIOC_S_PARM */
+    bool dequeue(v4l2_buffer& buf); /*!< DQBUF, false if none ready */
+    void requeue(v4l2_buffer& buf); /*!< hand a buffer back to the driver */
   public:
     //! Constructor for WebCam objects
     /*!
@@ -58,7 +68,8 @@ class Webcam {
            unsigned int cap_width = 800, /*!< [in] request width for V4L images.
                                             Value might be overriden by device. */
            unsigned int fps = 5, /*!< [in] request fps for capture. */
-           unsigned int buffer_count = 5/*! [in] num of capture buffers to request. */
+           unsigned int buffer_count = 5, /*! [in] num of capture buffers to request. */
+           CaptureFormat format = CaptureFormat::RGB24 /*!< [in] pixel format */
         );
 
     //! Will deinit V4L if the device is still open
@@ -86,9 +97,41 @@ class Webcam {
     void end_capture();
     std::shared_ptr<Frame> grab_frame();
 
+    //! Dequeue and immediately requeue a frame without copying it
+    /*!
+     *  Used to skip frames at the source under load. Returns false if no
+     *  frame was ready.
+     */
+    bool discard_frame();
+
+    //! Dequeue a frame, copying it only if it is sharper than best
+    /*!
+     *  Scores the mapped buffer without copying it (gradient energy of the
+     *  green channel for RGB24, compressed size for MJPEG where detail
+     *  costs bits) and replaces best/best_score if best is empty or the
+     *  new frame scores higher. Keeps the sharpest frame of a group
+     *  without copying all of them. Returns false if no frame was ready.
+     */
+    bool grab_if_sharper(std::shared_ptr<Frame>& best, uint32_t& best_score);
+
+    //! Change the capture framerate
+    /*!
+     *  Can be called while streaming, not all drivers support this though
+     *  and a std::system_error is thrown if the ioctl fails.
+     */
+    void set_fps(unsigned int fps);
+
+    //! Change the requested capture resolution
+    /*!
+     *  Only takes effect on the next \sa init(), so the device must be
+     *  closed and reinitialised to apply it.
+     */
+    void set_resolution(unsigned int width, unsigned int height);
+
     int fd() const;
     unsigned int cap_width() const;
     unsigned int cap_height() const;
+    unsigned int fps() const;
 };
 
 }
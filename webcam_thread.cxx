@@ -2,109 +2,367 @@
 #include "webcam_thread.h"
 #include "frame.h"
 #include "threadsafe_queue.h"
+#include "trace.h"
+#include "log_limit.h"
 
 #include <chrono>
 #include <string>
-#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
 #include <system_error>
 #include <stdexcept>
 
-#include <sys/time.h>
-#include <sys/types.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #include <spdlog/spdlog.h>
 
+using zxwebcam::Webcam;
+
+// epoll tokens for the non-camera fds, cameras use their index
+static const uint64_t SHUTDOWN_TOKEN = UINT64_MAX;
+static const uint64_t STATS_TOKEN = UINT64_MAX - 1;
+static const uint64_t CONTROL_TOKEN = UINT64_MAX - 2;
+
+static const int MAX_EVENTS = 8;
+static const auto CONTROL_INTERVAL = std::chrono::milliseconds{500};
+
+// frames to pick the sharpest from when the queue backs up on its own
+static const unsigned int SATURATED_GROUP = 2;
+
+// FPS measurement and some metrics plus load shedding state, per device
+struct CameraState {
+  int frame_count;
+  int dropped_frames;
+  int skipped_frames;  // lost to a sharper frame of their selection group
+  int budget_frames;   // discarded while over the memory budget
+  int interval_frames; // frames seen since the last stats tick
+  unsigned int group_pos; // arrivals so far in the current selection group
+  bool emulate_fps; // driver can't change fps while streaming, skip instead
+  FramePtr candidate; // sharpest frame of the current group
+  uint32_t candidate_score;
+  // per device, so one silent camera doesn't mute warnings about the others
+  std::unique_ptr<LogRateLimit> timeout_log;
+  std::unique_ptr<LogRateLimit> queue_full_log;
+};
+
+static void epoll_add(int epfd, int fd, uint64_t token) {
+  epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.u64 = token;
+
+  if (-1 == epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+    throw std::system_error(errno, std::generic_category(),
+            "Unable to add fd to epoll set");
+  }
+}
+
+static int create_timer(std::chrono::milliseconds interval) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  if (fd == -1) {
+    throw std::system_error(errno, std::generic_category(),
+            "Unable to create timer");
+  }
+
+  itimerspec spec = {};
+  spec.it_interval.tv_sec = interval.count() / 1000;
+  spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+  spec.it_value = spec.it_interval;
+
+  if (-1 == timerfd_settime(fd, 0, &spec, NULL)) {
+    close(fd);
+    throw std::system_error(errno, std::generic_category(),
+            "Unable to arm timer");
+  }
+
+  return fd;
+}
+
+/* Apply a new load level to all cameras. Resolution changes need a full
+ * stream restart, after which the new device fd is added back to the epoll
+ * set (closing the old one removed it). */
+static void apply_load(const WebcamSetup& ws,
+                       std::vector<std::unique_ptr<Webcam>>& cams,
+                       std::vector<CameraState>& state,
+                       const CaptureLoad& load, CaptureLoad& applied,
+                       int epfd) {
+  auto logger = spdlog::get("console");
+
+  if (load.res_div_ != applied.res_div_) {
+    for (size_t n = 0; n < cams.size(); n++) {
+      auto& v = cams[n];
+      v->close();
+      v->set_resolution(ws.res_x_ / load.res_div_, ws.res_y_ / load.res_div_);
+      v->set_fps(std::max(1u, ws.fps_ / load.fps_div_));
+      v->init();
+      v->start_capture();
+      epoll_add(epfd, v->fd(), n);
+
+      // init() applies the fps before streaming starts
+      state[n].emulate_fps = false;
+
+      logger->info("Restarted {} at {}x{}", ws.devices_[n],
+                   v->cap_width(), v->cap_height());
+    }
+  } else if (load.fps_div_ != applied.fps_div_) {
+    for (size_t n = 0; n < cams.size(); n++) {
+      try {
+        cams[n]->set_fps(std::max(1u, ws.fps_ / load.fps_div_));
+        state[n].emulate_fps = false;
+      } catch (const std::system_error& e) {
+        logger->warn("Could not change fps on {}, skipping frames instead: <{}>",
+                     ws.devices_[n], e.what());
+        state[n].emulate_fps = true;
+      }
+    }
+  }
+
+  applied = load;
+}
+
 void webcam_thread(WebcamSetup ws, ThreadsafeQueue<FramePtr>& queue,
-                   std::atomic_bool& exit_flag) {
+                   BackpressureController& controller,
+                   MemoryBudget& budget,
+                   Shutdown& shutdown) {
 
   auto logger = spdlog::get("console");
+  TRACE_THREAD("capture");
   
-  // FPS measurement and some metrics
-  int frame_count = 0;
-  int dropped_frames = 0;
   const int fps_div_sb = 3; // divide by shifting 3 bit pos (/8)
   auto fps_log_seconds = std::chrono::seconds{1 << fps_div_sb};
-  std::chrono::time_point<std::chrono::steady_clock>  start_time = \
-                std::chrono::steady_clock::now(), now_time;
 
+  std::vector<std::unique_ptr<Webcam>> cams;
+  std::vector<CameraState> state;
+  for (size_t n = 0; n < ws.devices_.size(); n++) {
+    state.push_back(CameraState{0, 0, 0, 0, 0, 0, false, nullptr, 0,
+        std::unique_ptr<LogRateLimit>(
+            new LogRateLimit(std::chrono::milliseconds{60000})),
+        std::unique_ptr<LogRateLimit>(
+            new LogRateLimit(std::chrono::milliseconds{5000}))});
+  }
+  CaptureLoad applied = controller.load();
 
-  zxwebcam::Webcam v(ws.device_, ws.res_y_, ws.res_x_, ws.fps_, ws.fps_);
+  for (auto& device : ws.devices_) {
+    cams.emplace_back(new Webcam(device, ws.res_y_, ws.res_x_,
+                                 ws.fps_, ws.fps_,
+                                 ws.mjpeg_ ? zxwebcam::CaptureFormat::MJPEG
+                                           : zxwebcam::CaptureFormat::RGB24));
   
-  logger->info("Initialising webcam {} with res {}x{} @ {} fps",
-               ws.device_, ws.res_x_, ws.res_y_, ws.fps_);
-  try {
-    v.init();
-  } catch (const std::runtime_error& e) {
-    logger->error("Could not initialise webcam device: <{}>",
-                  e.what());
-    exit_flag = true;
-    return;
+    logger->info("Initialising webcam {} with res {}x{} @ {} fps",
+                 device, ws.res_x_, ws.res_y_, ws.fps_);
+    try {
+      cams.back()->init();
+    } catch (const std::runtime_error& e) {
+      logger->error("Could not initialise webcam device: <{}>",
+                    e.what());
+      shutdown.request();
+      return;
+    }
+
+    try {
+      cams.back()->start_capture();
+    } catch (const std::runtime_error& e) {
+      logger->error("Could not start capture: <{}>",
+                    e.what());
+      shutdown.request();
+      return;
+    }
   }
 
+  int epfd = -1;
+  int stats_fd = -1;
+  int control_fd = -1;
+
   try {
-    v.start_capture();
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+      throw std::system_error(errno, std::generic_category(),
+              "Unable to create epoll instance");
+    }
+
+    stats_fd = create_timer(fps_log_seconds);
+    control_fd = create_timer(CONTROL_INTERVAL);
+
+    epoll_add(epfd, shutdown.fd(), SHUTDOWN_TOKEN);
+    epoll_add(epfd, stats_fd, STATS_TOKEN);
+    epoll_add(epfd, control_fd, CONTROL_TOKEN);
+    for (size_t n = 0; n < cams.size(); n++) {
+      epoll_add(epfd, cams[n]->fd(), n);
+    }
   } catch (const std::runtime_error& e) {
-    logger->error("Could not start capture: <{}>",
-                  e.what());
-    exit_flag = true;
-    return;
+    logger->error("Could not set up capture loop: <{}>", e.what());
+    shutdown.request();
   }
 
-  while (!exit_flag) {
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(v.fd(), &fds);
+  // last resort when the controller is disabled or can't keep up
+  const int max_queue = static_cast<int>(ws.fps_ * cams.size());
 
-    timeval timeout = {1, 0}; // 1 sec timeout
-    int ret = select(v.fd()+1, &fds, NULL, NULL, &timeout);
+  while (!shutdown.requested()) {
+    epoll_event events[MAX_EVENTS];
+    int ret = epoll_wait(epfd, events, MAX_EVENTS, -1);
 
-    switch(ret) {
-      case -1:
-        logger->error("select() call error with errno {}", errno);
-        return;
-      case 0:
-        logger->warn("timeout waiting for frame from webcam.");
+    if (ret == -1) {
+      if (errno == EINTR)
         continue;
-      default:
-        break;
+      logger->error("epoll_wait() call error with errno {}", errno);
+      shutdown.request();
+      break;
     }
 
-    FramePtr f = v.grab_frame();
-  
-    if (f == nullptr)
-      continue;
-    
-
-    //TODO: put the hardcoded magic num somewhere sensible
-    if (queue.size() > (int)(ws.fps_)) {
-      logger->warn("Frame queue full, discarding frame.");
-      dropped_frames++;
-    } else {
-      queue.push(f);
-      frame_count++;
-    }
+    for (int e = 0; e < ret; e++) {
+      uint64_t token = events[e].data.u64;
+      uint64_t expirations = 0;
 
-    now_time = std::chrono::steady_clock::now();
+      if (token == SHUTDOWN_TOKEN) {
+        break; // loop condition picks this up
+      }
 
-    if (now_time - start_time >= fps_log_seconds) {
-      // log fps
-      logger->info("frames {}, dropped {} frames, avg fps {}",
-          frame_count,
-          dropped_frames,
-          (frame_count >> fps_div_sb));
+      if (token == CONTROL_TOKEN) {
+        if (read(control_fd, &expirations, sizeof(expirations)) < 0)
+          continue;
+
+        if (!controller.tick(queue.size()))
+          continue;
+
+        auto load = controller.load();
+        logger->info("Load level {} (decode latency {}ms, queue {}): "
+                     "keep 1/{}, fps/{}, res/{}",
+                     controller.level(), controller.latency_ms(), queue.size(),
+                     load.keep_every_, load.fps_div_, load.res_div_);
+        try {
+          apply_load(ws, cams, state, load, applied, epfd);
+        } catch (const std::runtime_error& e) {
+          logger->error("Could not apply capture settings: <{}>", e.what());
+          shutdown.request();
+        }
+        break; // fds may have changed, don't use stale events
+      }
+
+      if (token == STATS_TOKEN) {
+        if (read(stats_fd, &expirations, sizeof(expirations)) < 0)
+          continue;
+
+        for (size_t n = 0; n < cams.size(); n++) {
+          auto& s = state[n];
+          if (s.interval_frames == 0) {
+            LOG_LIMITED_BY(*s.timeout_log, logger, warn,
+                           "timeout waiting for frame from webcam {}.",
+                           ws.devices_[n]);
+          }
+
+          // log fps
+          logger->info("{}: frames {}, dropped {} frames, skipped {}, "
+              "over memory budget {}, avg fps {}",
+              ws.devices_[n],
+              s.frame_count,
+              s.dropped_frames,
+              s.skipped_frames,
+              s.budget_frames,
+              (s.frame_count >> fps_div_sb));
+
+          s.frame_count = 0;
+          s.skipped_frames = 0;
+          s.budget_frames = 0;
+          s.interval_frames = 0;
+        }
+
+        if (budget.limit() > 0) {
+          logger->info("memory {} of {} KiB, peak {} KiB",
+                       budget.used() >> 10, budget.limit() >> 10,
+                       budget.peak() >> 10);
+        }
+        continue;
+      }
 
-      frame_count = 0;
-      start_time = now_time;
+      auto& s = state[token];
+      auto& v = cams[token];
+      FramePtr f;
+
+      unsigned int keep_every = applied.keep_every_;
+      if (s.emulate_fps)
+        keep_every *= applied.fps_div_;
+
+      try {
+        if (queue.size() > max_queue) {
+          if (v->discard_frame()) {
+            LOG_LIMITED_BY(*s.queue_full_log, logger, warn,
+                           "Frame queue full, discarding frames from {}.",
+                           ws.devices_[token]);
+            s.dropped_frames++;
+            s.interval_frames++;
+          }
+          continue;
+        }
+
+        if (budget.exceeded()) {
+          // frames and results still in flight use up the budget
+          if (v->discard_frame()) {
+            s.budget_frames++;
+            s.interval_frames++;
+          }
+          continue;
+        }
+
+        // decode is saturated if the controller sheds frames or the queue
+        // is half way to the hard limit, then only the sharpest of each
+        // group of arrivals is sent on (motion blurred frames rarely read)
+        unsigned int group = keep_every;
+        if (queue.size() > max_queue / 2)
+          group = std::max(group, SATURATED_GROUP);
+
+        if ((group == 1) && (s.candidate == nullptr)) {
+          f = v->grab_frame();
+        } else {
+          // scored in place, only frames sharper than the candidate are copied
+          if (!v->grab_if_sharper(s.candidate, s.candidate_score))
+            continue;
+
+          if (++s.group_pos < group) {
+            s.skipped_frames++;
+            s.interval_frames++;
+            continue;
+          }
+
+          f = s.candidate;
+          s.candidate = nullptr;
+          s.group_pos = 0;
+        }
+      } catch (const std::runtime_error& e) {
+        logger->error("Could not grab frame from {}: <{}>",
+                      ws.devices_[token], e.what());
+        shutdown.request();
+        break;
+      }
+  
+      if (f == nullptr)
+        continue;
+
+      f->set_device(token);
+      f->set_luma_scale(ws.luma_scale_);
+      f->set_budget(&budget);
+      s.interval_frames++;
+      TRACE_SPAN("enqueue", f->id());
+      queue.push(f);
+      s.frame_count++;
     }
   }
+
+  if (control_fd != -1) { close(control_fd); }
+  if (stats_fd != -1) { close(stats_fd); }
+  if (epfd != -1) { close(epfd); }
   
-  try {
-    v.end_capture();
-    v.close();
-  } catch (const std::runtime_error& e) {
-    logger->error("Could not shutdown webcam device: {}",
-                  e.what());
-    exit_flag = true;
+  for (auto& v : cams) {
+    try {
+      v->end_capture();
+      v->close();
+    } catch (const std::runtime_error& e) {
+      logger->error("Could not shutdown webcam device: {}",
+                    e.what());
+      shutdown.request();
+    }
   }
 }
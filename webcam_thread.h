@@ -3,19 +3,33 @@
 
 #include "frame.h"
 #include "threadsafe_queue.h"
+#include "shutdown.h"
+#include "backpressure.h"
+#include "memory_budget.h"
 
 #include <string>
-#include <atomic>
+#include <vector>
 
 struct WebcamSetup {
-  std::string device_;
+  std::vector<std::string> devices_;
   unsigned int res_x_;
   unsigned int res_y_;
   unsigned int fps_;
+  bool mjpeg_;              // capture MJPEG instead of RGB24
+  unsigned int luma_scale_; // DCT scale denominator for MJPEG luma decode
 };
 
+/* Capture frames from all configured devices into queue.
+ *
+ * Runs an epoll loop over the device fds, timerfds for periodic stats and
+ * backpressure control, and the shutdown eventfd, so a shutdown request
+ * interrupts the loop at once. Captured frames are charged against budget,
+ * frames are discarded at the source while it is exceeded.
+ */
 void webcam_thread(WebcamSetup ws, ThreadsafeQueue<FramePtr>& queue,
-                   std::atomic_bool& exit_flag);
+                   BackpressureController& controller,
+                   MemoryBudget& budget,
+                   Shutdown& shutdown);
  
 
 #endif